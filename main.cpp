@@ -1,8 +1,40 @@
 
 #include <math.h>
+#include <glew.h>    // GL 1.5+ entry points (buffer objects); must precede gl.h
 #include <glut.h>    // Use FreeGLUT for *Up callbacks
 #include <SOIL2.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <new>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDir(p) _mkdir(p)
+#else
+#define makeDir(p) mkdir(p, 0755)
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>  // x86-64 baseline; the flicker kernel falls back to 4 wide
+#endif
 
 // ---------------- Window & projection ----------------
 int   win_posx = 100, win_posy = 100;
@@ -31,6 +63,8 @@ int   boostActive = 0;          // SHIFT boosts speed
 
 // look smoothing
 float lookSpeed = 85.0f;        // deg/s when holding arrow
+float mouseSensitivity = 0.10f; // deg per pixel (Tab captures the mouse)
+float mouseSmoothing = 0.0f;    // s; 0 applies each step's motion at once
 
 // computed every frame (forward/right/up unit vectors)
 float fwdX = 0, fwdY = 0, fwdZ = -1;
@@ -49,6 +83,23 @@ float earthAngle = 0.0f; // rotation of the textured Earth
 
 // ---------------- Toggles ----------------
 int showAxes = 0;
+int showStats = 0;     // I toggles the stats overlay
+int occlusion_on = 1;  // O toggles CPU occlusion culling
+int lod_on = 1;        // L toggles mesh LOD selection (off = finest level)
+int g_onDemand = 0;    // U: redraw only when something changes
+
+// ---------------- Scene objects (world bounds for culling) ----------------
+enum { OBJ_TABLE, OBJ_CHAIR0, OBJ_CHAIR1, OBJ_CHAIR2, OBJ_CHAIR3, OBJ_EARTH, OBJ_LAMP, OBJ_COUNT };
+struct SceneObject { float bmin[3], bmax[3]; int visible; };
+SceneObject g_objects[OBJ_COUNT];
+struct ChairPlacement { float x, z, rotY; };
+ChairPlacement g_chairs[4];
+
+// ---------------- Frame stats ----------------
+float g_frameMs = 0.0f;  // smoothed frame-to-frame time
+double g_lastFrameMs = 0.0;
+struct OcclusionStats { int tested, occluded, outside, drawn, occluderTris; float costMs, lastMs; };
+OcclusionStats g_occStats;
 
 // ---------------- Textures (SOIL2) ----------------
 GLuint texFloor = 0, texWall = 0, texCeil = 0, texWood = 0, texPainting = 0, texEarth = 0;
@@ -62,31 +113,828 @@ static void cross3(float ax, float ay, float az, float bx, float by, float bz, f
     *rx = ay * bz - az * by; *ry = az * bx - ax * bz; *rz = ax * by - ay * bx;
 }
 static float fractf(float x) { return x - floorf(x); }
+static double nowMs() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
 
-static GLuint loadTextureSOIL(const char* file, int invertY) {
-    int flags = SOIL_FLAG_MIPMAPS | (invertY ? SOIL_FLAG_INVERT_Y : 0);
-    GLuint id = SOIL_load_OGL_texture(file, SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, flags);
-    if (!id) {
-        printf("SOIL2: failed to load '%s' : %s\n", file, SOIL_last_result());
-        return 0;
+// sorts v in place
+static float percentileInPlace(float* v, int n, float p) {
+    if (n <= 0) return 0.0f;
+    std::sort(v, v + n);
+    return v[(size_t)clampf(p * (n - 1) + 0.5f, 0.0f, (float)(n - 1))];
+}
+static float percentile(std::vector<float> v, float p) { return percentileInPlace(v.data(), (int)v.size(), p); }
+
+static void flipRows(unsigned char* px, int w, int h) {
+    int stride = w * 4;
+    std::vector<unsigned char> row(stride);
+    for (int y = 0; y < h / 2; ++y) {
+        unsigned char* a = px + y * stride; unsigned char* b = px + (h - 1 - y) * stride;
+        memcpy(row.data(), a, stride); memcpy(a, b, stride); memcpy(b, row.data(), stride);
     }
-    glBindTexture(GL_TEXTURE_2D, id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    printf("SOIL2: loaded '%s' (id=%u)\n", file, id);
-    return id;
 }
 
+// 4x4 matrices, column-major like OpenGL (m[col * 4 + row])
+static void mat4Mul(float* r, const float* a, const float* b) {
+    float t[16];
+    for (int c = 0; c < 4; ++c)
+        for (int rr = 0; rr < 4; ++rr)
+            t[c * 4 + rr] = a[rr] * b[c * 4] + a[4 + rr] * b[c * 4 + 1] + a[8 + rr] * b[c * 4 + 2] + a[12 + rr] * b[c * 4 + 3];
+    memcpy(r, t, sizeof(t));
+}
+static void mat4LookAt(float* m, float ex, float ey, float ez, float fx, float fy, float fz, float ux, float uy, float uz) {
+    // same as gluLookAt(eye, eye + f, up)
+    norm3(&fx, &fy, &fz);
+    float sx, sy, sz, vx, vy, vz;
+    cross3(fx, fy, fz, ux, uy, uz, &sx, &sy, &sz); norm3(&sx, &sy, &sz);
+    cross3(sx, sy, sz, fx, fy, fz, &vx, &vy, &vz);
+    m[0] = sx; m[4] = sy; m[8] = sz;  m[12] = -(sx * ex + sy * ey + sz * ez);
+    m[1] = vx; m[5] = vy; m[9] = vz;  m[13] = -(vx * ex + vy * ey + vz * ez);
+    m[2] = -fx; m[6] = -fy; m[10] = -fz; m[14] = (fx * ex + fy * ey + fz * ez);
+    m[3] = 0; m[7] = 0; m[11] = 0; m[15] = 1;
+}
+static void mat4Perspective(float* m, float fovyDeg, float aspect, float zn, float zf) {
+    float f = 1.0f / tanf(fovyDeg * 0.5f * DEG2RAD);
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = f / aspect; m[5] = f;
+    m[10] = (zf + zn) / (zn - zf); m[11] = -1.0f;
+    m[14] = 2.0f * zf * zn / (zn - zf);
+}
+static void mat4Ortho(float* m, float l, float r, float b, float t, float zn, float zf) {
+    memset(m, 0, 16 * sizeof(float));
+    m[0] = 2.0f / (r - l); m[5] = 2.0f / (t - b); m[10] = -2.0f / (zf - zn);
+    m[12] = -(r + l) / (r - l); m[13] = -(t + b) / (t - b); m[14] = -(zf + zn) / (zf - zn); m[15] = 1.0f;
+}
+static void mat4TransformPoint(const float* m, float x, float y, float z, float* out4) {
+    out4[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+    out4[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+    out4[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+    out4[3] = m[3] * x + m[7] * y + m[11] * z + m[15];
+}
+// post-multiplying transforms, like glTranslatef / glRotatef / glScalef
+static void mat4Identity(float* m) { memset(m, 0, 16 * sizeof(float)); m[0] = m[5] = m[10] = m[15] = 1.0f; }
+static void mat4Translate(float* m, float x, float y, float z) {
+    float t[16]; mat4Identity(t);
+    t[12] = x; t[13] = y; t[14] = z;
+    mat4Mul(m, m, t);
+}
+static void mat4Rotate(float* m, float deg, float x, float y, float z) { // (x, y, z) unit length
+    float c = cosf(deg * DEG2RAD), s = sinf(deg * DEG2RAD), k = 1.0f - c;
+    float r[16] = { x * x * k + c, y * x * k + z * s, x * z * k - y * s, 0,
+                    x * y * k - z * s, y * y * k + c, y * z * k + x * s, 0,
+                    x * z * k + y * s, y * z * k - x * s, z * z * k + c, 0,
+                    0, 0, 0, 1 };
+    mat4Mul(m, m, r);
+}
+static void mat4Scale(float* m, float x, float y, float z) {
+    float t[16]; mat4Identity(t);
+    t[0] = x; t[5] = y; t[10] = z;
+    mat4Mul(m, m, t);
+}
+
+// ---------------- Profiler (ROOM_PROFILE; F9: dump trace) ----------------
+// Scoped zones recorded as complete events into a ring per thread (one
+// writer each, no locks on the recording path). F9 and program exit write the
+// last PROFILE_DUMP_SECONDS as Chrome trace-event JSON, viewable in
+// chrome://tracing or Perfetto. Without ROOM_PROFILE the macros expand to
+// nothing.
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#ifdef ROOM_PROFILE
+#define PROFILE_RING 65536              // events per thread (power of two)
+#define PROFILE_DUMP_SECONDS 5
+struct ProfEvent { const char* name; uint64_t t0, t1; };
+struct ProfRing {
+    ProfEvent ev[PROFILE_RING];
+    std::atomic<uint64_t> head{ 0 };    // events ever written
+    int tid;
+    char name[32];
+};
+std::mutex g_profMutex;                 // guards the ring list and names (not the recording)
+std::vector<ProfRing*> g_profRings;
+thread_local ProfRing* t_profRing = nullptr;
+int g_profDumps = 0;
+
+static uint64_t profNowNs() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static ProfRing* profRing() {
+    if (!t_profRing) {
+        ProfRing* r = new ProfRing();
+        std::lock_guard<std::mutex> lk(g_profMutex);
+        r->tid = (int)g_profRings.size() + 1;
+        snprintf(r->name, sizeof(r->name), "thread %d", r->tid);
+        g_profRings.push_back(r);
+        t_profRing = r;
+    }
+    return t_profRing;
+}
+
+static void profThreadName(const char* name) {
+    ProfRing* r = profRing();
+    std::lock_guard<std::mutex> lk(g_profMutex);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+}
+
+struct ProfScope {
+    const char* name;
+    uint64_t t0;
+    explicit ProfScope(const char* n) : name(n), t0(profNowNs()) {}
+    ~ProfScope() {
+        ProfRing* r = profRing();
+        uint64_t h = r->head.load(std::memory_order_relaxed);
+        ProfEvent& e = r->ev[h & (PROFILE_RING - 1)];
+        e.name = name; e.t0 = t0; e.t1 = profNowNs();
+        r->head.store(h + 1, std::memory_order_release);
+    }
+};
+
+// Copies each ring's tail while its thread keeps recording; events the
+// writer may have overwritten during the copy are dropped.
+void profDump() {
+    uint64_t now = profNowNs(), from = now - (uint64_t)PROFILE_DUMP_SECONDS * 1000000000ull;
+    char path[64];
+    snprintf(path, sizeof(path), "trace_%03d.json", g_profDumps++);
+    FILE* f = fopen(path, "w");
+    if (!f) { printf("Profiler: cannot write '%s'\n", path); return; }
+    std::lock_guard<std::mutex> lk(g_profMutex);
+    std::vector<ProfEvent> ev;
+    int count = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (ProfRing* r : g_profRings) {
+        uint64_t h = r->head.load(std::memory_order_acquire);
+        uint64_t lo = h > PROFILE_RING ? h - PROFILE_RING : 0;
+        ev.clear();
+        for (uint64_t i = lo; i < h; ++i) ev.push_back(r->ev[i & (PROFILE_RING - 1)]);
+        // events the writer overwrote while we copied, plus the slot it may
+        // be filling right now (index h2, not yet published)
+        uint64_t h2 = r->head.load(std::memory_order_acquire) + 1;
+        size_t skip = h2 > lo + PROFILE_RING ? (size_t)(h2 - lo - PROFILE_RING) : 0;
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", r->tid, r->name);
+        for (size_t i = skip; i < ev.size(); ++i) {
+            if (ev[i].t1 < from) continue;
+            uint64_t t0 = std::max(ev[i].t0, from);     // zones open at the window start are clipped to it
+            fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n", ev[i].name, r->tid,
+                (t0 - from) * 0.001, (ev[i].t1 - t0) * 0.001);
+            ++count;
+        }
+    }
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"room\"}}\n]}\n");
+    fclose(f);
+    printf("Profiler: %d zones from %d threads -> '%s'\n", count, (int)g_profRings.size(), path);
+}
+
+#define PROFILE_ZONE(name) ProfScope PROFILE_CONCAT(profZone_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#define PROFILE_THREAD(name) profThreadName(name)
+#define PROFILE_DUMP() profDump()
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#define PROFILE_DUMP() ((void)0)
+#endif
+
+// ---------------- GL call statistics (ROOM_GL_STATS) ----------------
+// Counts every GL/GLU/GLUT call the renderer makes, per frame, by category
+// and by the draw function that issued it. Each entry point is shadowed by a
+// function-like macro of the same name; inside its own expansion the name is
+// not expanded again, so the macro bumps a counter and then calls the real
+// function. Entry points past GL 1.1 are GLEW object-like macros over a
+// function pointer; those are undefined and rewrapped to call the pointer.
+#ifdef ROOM_GL_STATS
+enum { GLS_IMMEDIATE, GLS_MATRIX, GLS_STATE, GLS_TEXTURE, GLS_LIGHTING, GLS_ARRAYS, GLS_DRAW, GLS_TEXT,
+       GLS_BUFFER, GLS_SHADER, GLS_FBO, GLS_QUERY, GLS_CATEGORIES };
+const char* kGlsCategoryName[GLS_CATEGORIES] = { "immediate", "matrix", "state", "texture", "lighting", "arrays", "draw", "text",
+                                                 "buffer", "shader", "fbo", "query" };
+#define GLS_MAX_SCOPES 32
+struct GlStats { unsigned calls[GLS_MAX_SCOPES][GLS_CATEGORIES]; };
+const char* g_glsScopeName[GLS_MAX_SCOPES] = { "(unscoped)" };
+int g_glsScopes = 1;
+int g_glsScope = 0;                 // GL is only called from the main thread
+GlStats g_glStats;                  // frame in progress
+GlStats g_glStatsFrame;             // last completed frame
+double g_glsSum[GLS_CATEGORIES];    // totals since glStatsReset(), for benchmarks
+int g_glsFrames = 0;
+
+static inline void glStatCall(int cat) { g_glStats.calls[g_glsScope][cat]++; }
+
+static int glStatsScopeIndex(const char* name) {
+    for (int i = 1; i < g_glsScopes; ++i) if (g_glsScopeName[i] == name) return i;
+    if (g_glsScopes == GLS_MAX_SCOPES) return 0;
+    g_glsScopeName[g_glsScopes] = name;
+    return g_glsScopes++;
+}
+
+struct GlStatsScope {
+    int prev;
+    explicit GlStatsScope(const char* name) : prev(g_glsScope) { g_glsScope = glStatsScopeIndex(name); }
+    ~GlStatsScope() { g_glsScope = prev; }
+};
+
+static unsigned glStatsCategory(const GlStats& s, int cat) {
+    unsigned n = 0;
+    for (int i = 0; i < g_glsScopes; ++i) n += s.calls[i][cat];
+    return n;
+}
+static unsigned glStatsScopeTotal(const GlStats& s, int scope) {
+    unsigned n = 0;
+    for (int c = 0; c < GLS_CATEGORIES; ++c) n += s.calls[scope][c];
+    return n;
+}
+static unsigned glStatsTotal(const GlStats& s) {
+    unsigned n = 0;
+    for (int c = 0; c < GLS_CATEGORIES; ++c) n += glStatsCategory(s, c);
+    return n;
+}
+
+void glStatsEndFrame() {
+    g_glStatsFrame = g_glStats;
+    for (int c = 0; c < GLS_CATEGORIES; ++c) g_glsSum[c] += glStatsCategory(g_glStats, c);
+    g_glsFrames++;
+    memset(&g_glStats, 0, sizeof(g_glStats));
+}
+
+void glStatsReset() {
+    memset(g_glsSum, 0, sizeof(g_glsSum));
+    g_glsFrames = 0;
+}
+
+// average calls per frame since glStatsReset()
+void glStatsPrint(const char* label) {
+    if (!g_glsFrames) return;
+    double total = 0;
+    for (int c = 0; c < GLS_CATEGORIES; ++c) total += g_glsSum[c];
+    printf("%s: %.0f GL calls/frame (", label, total / g_glsFrames);
+    for (int c = 0; c < GLS_CATEGORIES; ++c) printf("%s%s %.0f", c ? ", " : "", kGlsCategoryName[c], g_glsSum[c] / g_glsFrames);
+    printf(")\n");
+}
+
+#define GLS_WRAP(cat, fn, ...) (glStatCall(cat), fn(__VA_ARGS__))
+#define GLS_WRAP_GLEW(cat, name, ...) (glStatCall(cat), GLEW_GET_FUN(__glew##name)(__VA_ARGS__))
+#define glBegin(...) GLS_WRAP(GLS_IMMEDIATE, glBegin, __VA_ARGS__)
+#define glEnd(...) GLS_WRAP(GLS_IMMEDIATE, glEnd, __VA_ARGS__)
+#define glVertex2f(...) GLS_WRAP(GLS_IMMEDIATE, glVertex2f, __VA_ARGS__)
+#define glVertex3f(...) GLS_WRAP(GLS_IMMEDIATE, glVertex3f, __VA_ARGS__)
+#define glNormal3f(...) GLS_WRAP(GLS_IMMEDIATE, glNormal3f, __VA_ARGS__)
+#define glTexCoord2f(...) GLS_WRAP(GLS_IMMEDIATE, glTexCoord2f, __VA_ARGS__)
+#define glColor3f(...) GLS_WRAP(GLS_IMMEDIATE, glColor3f, __VA_ARGS__)
+#define glMatrixMode(...) GLS_WRAP(GLS_MATRIX, glMatrixMode, __VA_ARGS__)
+#define glLoadIdentity(...) GLS_WRAP(GLS_MATRIX, glLoadIdentity, __VA_ARGS__)
+#define glPushMatrix(...) GLS_WRAP(GLS_MATRIX, glPushMatrix, __VA_ARGS__)
+#define glPopMatrix(...) GLS_WRAP(GLS_MATRIX, glPopMatrix, __VA_ARGS__)
+#define glTranslatef(...) GLS_WRAP(GLS_MATRIX, glTranslatef, __VA_ARGS__)
+#define glRotatef(...) GLS_WRAP(GLS_MATRIX, glRotatef, __VA_ARGS__)
+#define glScalef(...) GLS_WRAP(GLS_MATRIX, glScalef, __VA_ARGS__)
+#define glMultMatrixf(...) GLS_WRAP(GLS_MATRIX, glMultMatrixf, __VA_ARGS__)
+#define glOrtho(...) GLS_WRAP(GLS_MATRIX, glOrtho, __VA_ARGS__)
+#define gluLookAt(...) GLS_WRAP(GLS_MATRIX, gluLookAt, __VA_ARGS__)
+#define gluPerspective(...) GLS_WRAP(GLS_MATRIX, gluPerspective, __VA_ARGS__)
+#define gluOrtho2D(...) GLS_WRAP(GLS_MATRIX, gluOrtho2D, __VA_ARGS__)
+#define glEnable(...) GLS_WRAP(GLS_STATE, glEnable, __VA_ARGS__)
+#define glDisable(...) GLS_WRAP(GLS_STATE, glDisable, __VA_ARGS__)
+#define glHint(...) GLS_WRAP(GLS_STATE, glHint, __VA_ARGS__)
+#define glShadeModel(...) GLS_WRAP(GLS_STATE, glShadeModel, __VA_ARGS__)
+#define glViewport(...) GLS_WRAP(GLS_STATE, glViewport, __VA_ARGS__)
+#define glClearColor(...) GLS_WRAP(GLS_STATE, glClearColor, __VA_ARGS__)
+#define glClearDepth(...) GLS_WRAP(GLS_STATE, glClearDepth, __VA_ARGS__)
+#define glPixelStorei(...) GLS_WRAP(GLS_STATE, glPixelStorei, __VA_ARGS__)
+#define glGetIntegerv(...) GLS_WRAP(GLS_STATE, glGetIntegerv, __VA_ARGS__)
+#define glFogi(...) GLS_WRAP(GLS_STATE, glFogi, __VA_ARGS__)
+#define glFogf(...) GLS_WRAP(GLS_STATE, glFogf, __VA_ARGS__)
+#define glFogfv(...) GLS_WRAP(GLS_STATE, glFogfv, __VA_ARGS__)
+#define glBlendFunc(...) GLS_WRAP(GLS_STATE, glBlendFunc, __VA_ARGS__)
+#define glDepthFunc(...) GLS_WRAP(GLS_STATE, glDepthFunc, __VA_ARGS__)
+#define glDepthMask(...) GLS_WRAP(GLS_STATE, glDepthMask, __VA_ARGS__)
+#define glColorMask(...) GLS_WRAP(GLS_STATE, glColorMask, __VA_ARGS__)
+#define glIsEnabled(...) GLS_WRAP(GLS_STATE, glIsEnabled, __VA_ARGS__)
+#define glBindTexture(...) GLS_WRAP(GLS_TEXTURE, glBindTexture, __VA_ARGS__)
+#define glTexParameteri(...) GLS_WRAP(GLS_TEXTURE, glTexParameteri, __VA_ARGS__)
+#define glTexEnvi(...) GLS_WRAP(GLS_TEXTURE, glTexEnvi, __VA_ARGS__)
+#define glTexImage2D(...) GLS_WRAP(GLS_TEXTURE, glTexImage2D, __VA_ARGS__)
+#define glGenTextures(...) GLS_WRAP(GLS_TEXTURE, glGenTextures, __VA_ARGS__)
+#define glDeleteTextures(...) GLS_WRAP(GLS_TEXTURE, glDeleteTextures, __VA_ARGS__)
+#define glTexSubImage2D(...) GLS_WRAP(GLS_TEXTURE, glTexSubImage2D, __VA_ARGS__)
+#define glLightf(...) GLS_WRAP(GLS_LIGHTING, glLightf, __VA_ARGS__)
+#define glLightfv(...) GLS_WRAP(GLS_LIGHTING, glLightfv, __VA_ARGS__)
+#define glLightModelfv(...) GLS_WRAP(GLS_LIGHTING, glLightModelfv, __VA_ARGS__)
+#define glMaterialf(...) GLS_WRAP(GLS_LIGHTING, glMaterialf, __VA_ARGS__)
+#define glMaterialfv(...) GLS_WRAP(GLS_LIGHTING, glMaterialfv, __VA_ARGS__)
+#define glColorMaterial(...) GLS_WRAP(GLS_LIGHTING, glColorMaterial, __VA_ARGS__)
+#define glEnableClientState(...) GLS_WRAP(GLS_ARRAYS, glEnableClientState, __VA_ARGS__)
+#define glDisableClientState(...) GLS_WRAP(GLS_ARRAYS, glDisableClientState, __VA_ARGS__)
+#define glVertexPointer(...) GLS_WRAP(GLS_ARRAYS, glVertexPointer, __VA_ARGS__)
+#define glNormalPointer(...) GLS_WRAP(GLS_ARRAYS, glNormalPointer, __VA_ARGS__)
+#define glTexCoordPointer(...) GLS_WRAP(GLS_ARRAYS, glTexCoordPointer, __VA_ARGS__)
+#define glDrawElements(...) GLS_WRAP(GLS_DRAW, glDrawElements, __VA_ARGS__)
+#define glDrawArrays(...) GLS_WRAP(GLS_DRAW, glDrawArrays, __VA_ARGS__)
+#define glClear(...) GLS_WRAP(GLS_DRAW, glClear, __VA_ARGS__)
+#define glReadPixels(...) GLS_WRAP(GLS_DRAW, glReadPixels, __VA_ARGS__)
+#define glFinish(...) GLS_WRAP(GLS_DRAW, glFinish, __VA_ARGS__)
+#define glRasterPos2f(...) GLS_WRAP(GLS_TEXT, glRasterPos2f, __VA_ARGS__)
+#define glutBitmapCharacter(...) GLS_WRAP(GLS_TEXT, glutBitmapCharacter, __VA_ARGS__)
+// GLEW entry points
+#undef glActiveTexture
+#define glActiveTexture(...) GLS_WRAP_GLEW(GLS_TEXTURE, ActiveTexture, __VA_ARGS__)
+#undef glTexImage3D
+#define glTexImage3D(...) GLS_WRAP_GLEW(GLS_TEXTURE, TexImage3D, __VA_ARGS__)
+#undef glTexStorage2D
+#define glTexStorage2D(...) GLS_WRAP_GLEW(GLS_TEXTURE, TexStorage2D, __VA_ARGS__)
+#undef glTexStorage3D
+#define glTexStorage3D(...) GLS_WRAP_GLEW(GLS_TEXTURE, TexStorage3D, __VA_ARGS__)
+#undef glTexSubImage3D
+#define glTexSubImage3D(...) GLS_WRAP_GLEW(GLS_TEXTURE, TexSubImage3D, __VA_ARGS__)
+#undef glGenerateMipmap
+#define glGenerateMipmap(...) GLS_WRAP_GLEW(GLS_TEXTURE, GenerateMipmap, __VA_ARGS__)
+#undef glCopyImageSubData
+#define glCopyImageSubData(...) GLS_WRAP_GLEW(GLS_TEXTURE, CopyImageSubData, __VA_ARGS__)
+#undef glBindImageTexture
+#define glBindImageTexture(...) GLS_WRAP_GLEW(GLS_TEXTURE, BindImageTexture, __VA_ARGS__)
+#undef glGenVertexArrays
+#define glGenVertexArrays(...) GLS_WRAP_GLEW(GLS_ARRAYS, GenVertexArrays, __VA_ARGS__)
+#undef glBindVertexArray
+#define glBindVertexArray(...) GLS_WRAP_GLEW(GLS_ARRAYS, BindVertexArray, __VA_ARGS__)
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray(...) GLS_WRAP_GLEW(GLS_ARRAYS, EnableVertexAttribArray, __VA_ARGS__)
+#undef glVertexAttribPointer
+#define glVertexAttribPointer(...) GLS_WRAP_GLEW(GLS_ARRAYS, VertexAttribPointer, __VA_ARGS__)
+#undef glVertexAttribIPointer
+#define glVertexAttribIPointer(...) GLS_WRAP_GLEW(GLS_ARRAYS, VertexAttribIPointer, __VA_ARGS__)
+#undef glVertexAttribDivisor
+#define glVertexAttribDivisor(...) GLS_WRAP_GLEW(GLS_ARRAYS, VertexAttribDivisor, __VA_ARGS__)
+#undef glMultiDrawElements
+#define glMultiDrawElements(...) GLS_WRAP_GLEW(GLS_DRAW, MultiDrawElements, __VA_ARGS__)
+#undef glMultiDrawElementsIndirect
+#define glMultiDrawElementsIndirect(...) GLS_WRAP_GLEW(GLS_DRAW, MultiDrawElementsIndirect, __VA_ARGS__)
+#undef glDispatchCompute
+#define glDispatchCompute(...) GLS_WRAP_GLEW(GLS_DRAW, DispatchCompute, __VA_ARGS__)
+#undef glMemoryBarrier
+#define glMemoryBarrier(...) GLS_WRAP_GLEW(GLS_DRAW, MemoryBarrier, __VA_ARGS__)
+#undef glGenBuffers
+#define glGenBuffers(...) GLS_WRAP_GLEW(GLS_BUFFER, GenBuffers, __VA_ARGS__)
+#undef glBindBuffer
+#define glBindBuffer(...) GLS_WRAP_GLEW(GLS_BUFFER, BindBuffer, __VA_ARGS__)
+#undef glBindBufferBase
+#define glBindBufferBase(...) GLS_WRAP_GLEW(GLS_BUFFER, BindBufferBase, __VA_ARGS__)
+#undef glBindBufferRange
+#define glBindBufferRange(...) GLS_WRAP_GLEW(GLS_BUFFER, BindBufferRange, __VA_ARGS__)
+#undef glBufferData
+#define glBufferData(...) GLS_WRAP_GLEW(GLS_BUFFER, BufferData, __VA_ARGS__)
+#undef glBufferStorage
+#define glBufferStorage(...) GLS_WRAP_GLEW(GLS_BUFFER, BufferStorage, __VA_ARGS__)
+#undef glBufferSubData
+#define glBufferSubData(...) GLS_WRAP_GLEW(GLS_BUFFER, BufferSubData, __VA_ARGS__)
+#undef glGetBufferSubData
+#define glGetBufferSubData(...) GLS_WRAP_GLEW(GLS_BUFFER, GetBufferSubData, __VA_ARGS__)
+#undef glMapBufferRange
+#define glMapBufferRange(...) GLS_WRAP_GLEW(GLS_BUFFER, MapBufferRange, __VA_ARGS__)
+#undef glUnmapBuffer
+#define glUnmapBuffer(...) GLS_WRAP_GLEW(GLS_BUFFER, UnmapBuffer, __VA_ARGS__)
+#undef glCreateShader
+#define glCreateShader(...) GLS_WRAP_GLEW(GLS_SHADER, CreateShader, __VA_ARGS__)
+#undef glShaderSource
+#define glShaderSource(...) GLS_WRAP_GLEW(GLS_SHADER, ShaderSource, __VA_ARGS__)
+#undef glCompileShader
+#define glCompileShader(...) GLS_WRAP_GLEW(GLS_SHADER, CompileShader, __VA_ARGS__)
+#undef glGetShaderiv
+#define glGetShaderiv(...) GLS_WRAP_GLEW(GLS_SHADER, GetShaderiv, __VA_ARGS__)
+#undef glGetShaderInfoLog
+#define glGetShaderInfoLog(...) GLS_WRAP_GLEW(GLS_SHADER, GetShaderInfoLog, __VA_ARGS__)
+#undef glDeleteShader
+#define glDeleteShader(...) GLS_WRAP_GLEW(GLS_SHADER, DeleteShader, __VA_ARGS__)
+#undef glCreateProgram
+#define glCreateProgram(...) GLS_WRAP_GLEW(GLS_SHADER, CreateProgram, __VA_ARGS__)
+#undef glAttachShader
+#define glAttachShader(...) GLS_WRAP_GLEW(GLS_SHADER, AttachShader, __VA_ARGS__)
+#undef glLinkProgram
+#define glLinkProgram(...) GLS_WRAP_GLEW(GLS_SHADER, LinkProgram, __VA_ARGS__)
+#undef glGetProgramiv
+#define glGetProgramiv(...) GLS_WRAP_GLEW(GLS_SHADER, GetProgramiv, __VA_ARGS__)
+#undef glGetProgramInfoLog
+#define glGetProgramInfoLog(...) GLS_WRAP_GLEW(GLS_SHADER, GetProgramInfoLog, __VA_ARGS__)
+#undef glDeleteProgram
+#define glDeleteProgram(...) GLS_WRAP_GLEW(GLS_SHADER, DeleteProgram, __VA_ARGS__)
+#undef glUseProgram
+#define glUseProgram(...) GLS_WRAP_GLEW(GLS_SHADER, UseProgram, __VA_ARGS__)
+#undef glGetUniformLocation
+#define glGetUniformLocation(...) GLS_WRAP_GLEW(GLS_SHADER, GetUniformLocation, __VA_ARGS__)
+#undef glUniform1f
+#define glUniform1f(...) GLS_WRAP_GLEW(GLS_SHADER, Uniform1f, __VA_ARGS__)
+#undef glUniform1i
+#define glUniform1i(...) GLS_WRAP_GLEW(GLS_SHADER, Uniform1i, __VA_ARGS__)
+#undef glUniform1ui
+#define glUniform1ui(...) GLS_WRAP_GLEW(GLS_SHADER, Uniform1ui, __VA_ARGS__)
+#undef glUniform2f
+#define glUniform2f(...) GLS_WRAP_GLEW(GLS_SHADER, Uniform2f, __VA_ARGS__)
+#undef glUniform3f
+#define glUniform3f(...) GLS_WRAP_GLEW(GLS_SHADER, Uniform3f, __VA_ARGS__)
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv(...) GLS_WRAP_GLEW(GLS_SHADER, UniformMatrix4fv, __VA_ARGS__)
+#undef glGenFramebuffers
+#define glGenFramebuffers(...) GLS_WRAP_GLEW(GLS_FBO, GenFramebuffers, __VA_ARGS__)
+#undef glBindFramebuffer
+#define glBindFramebuffer(...) GLS_WRAP_GLEW(GLS_FBO, BindFramebuffer, __VA_ARGS__)
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers(...) GLS_WRAP_GLEW(GLS_FBO, DeleteFramebuffers, __VA_ARGS__)
+#undef glGenRenderbuffers
+#define glGenRenderbuffers(...) GLS_WRAP_GLEW(GLS_FBO, GenRenderbuffers, __VA_ARGS__)
+#undef glBindRenderbuffer
+#define glBindRenderbuffer(...) GLS_WRAP_GLEW(GLS_FBO, BindRenderbuffer, __VA_ARGS__)
+#undef glDeleteRenderbuffers
+#define glDeleteRenderbuffers(...) GLS_WRAP_GLEW(GLS_FBO, DeleteRenderbuffers, __VA_ARGS__)
+#undef glRenderbufferStorageMultisample
+#define glRenderbufferStorageMultisample(...) GLS_WRAP_GLEW(GLS_FBO, RenderbufferStorageMultisample, __VA_ARGS__)
+#undef glFramebufferRenderbuffer
+#define glFramebufferRenderbuffer(...) GLS_WRAP_GLEW(GLS_FBO, FramebufferRenderbuffer, __VA_ARGS__)
+#undef glFramebufferTexture2D
+#define glFramebufferTexture2D(...) GLS_WRAP_GLEW(GLS_FBO, FramebufferTexture2D, __VA_ARGS__)
+#undef glCheckFramebufferStatus
+#define glCheckFramebufferStatus(...) GLS_WRAP_GLEW(GLS_FBO, CheckFramebufferStatus, __VA_ARGS__)
+#undef glBlitFramebuffer
+#define glBlitFramebuffer(...) GLS_WRAP_GLEW(GLS_FBO, BlitFramebuffer, __VA_ARGS__)
+#undef glGenQueries
+#define glGenQueries(...) GLS_WRAP_GLEW(GLS_QUERY, GenQueries, __VA_ARGS__)
+#undef glBeginQuery
+#define glBeginQuery(...) GLS_WRAP_GLEW(GLS_QUERY, BeginQuery, __VA_ARGS__)
+#undef glEndQuery
+#define glEndQuery(...) GLS_WRAP_GLEW(GLS_QUERY, EndQuery, __VA_ARGS__)
+#undef glQueryCounter
+#define glQueryCounter(...) GLS_WRAP_GLEW(GLS_QUERY, QueryCounter, __VA_ARGS__)
+#undef glGetQueryObjectiv
+#define glGetQueryObjectiv(...) GLS_WRAP_GLEW(GLS_QUERY, GetQueryObjectiv, __VA_ARGS__)
+#undef glGetQueryObjectuiv
+#define glGetQueryObjectuiv(...) GLS_WRAP_GLEW(GLS_QUERY, GetQueryObjectuiv, __VA_ARGS__)
+#undef glGetQueryObjectui64v
+#define glGetQueryObjectui64v(...) GLS_WRAP_GLEW(GLS_QUERY, GetQueryObjectui64v, __VA_ARGS__)
+#undef glGetInteger64v
+#define glGetInteger64v(...) GLS_WRAP_GLEW(GLS_QUERY, GetInteger64v, __VA_ARGS__)
+#undef glFenceSync
+#define glFenceSync(...) GLS_WRAP_GLEW(GLS_QUERY, FenceSync, __VA_ARGS__)
+#undef glClientWaitSync
+#define glClientWaitSync(...) GLS_WRAP_GLEW(GLS_QUERY, ClientWaitSync, __VA_ARGS__)
+#undef glDeleteSync
+#define glDeleteSync(...) GLS_WRAP_GLEW(GLS_QUERY, DeleteSync, __VA_ARGS__)
+
+#define GL_STATS_SCOPE(name) GlStatsScope PROFILE_CONCAT(glsScope_, __LINE__)(name)
+#define GL_STATS_END_FRAME() glStatsEndFrame()
+#define GL_STATS_RESET() glStatsReset()
+#define GL_STATS_PRINT(label) glStatsPrint(label)
+#else
+#define GL_STATS_SCOPE(name) ((void)0)
+#define GL_STATS_END_FRAME() ((void)0)
+#define GL_STATS_RESET() ((void)0)
+#define GL_STATS_PRINT(label) ((void)0)
+#endif
+
+// profiler zone + GL call bucket for a draw function
+#define DRAW_SCOPE() PROFILE_FUNCTION(); GL_STATS_SCOPE(__func__)
+
+// ---------------- Job system ----------------
+// One worker thread per core, each with a Chase-Lev work-stealing deque. The
+// owner pushes and pops at the bottom, idle threads steal from the top. A job
+// runs fn(i, ctx) for every i in [begin, end), a grain at a time. Before each
+// grain, if its owner's deque is empty, the job hands the upper half of what
+// is left back to it. An unstolen half keeps the deque non-empty, so a
+// parallel-for splits only as far as thieves actually take work. Counters
+// track jobs in flight; a job spawned "after" a counter waits until it
+// reaches zero.
+// jobWait() helps with queued jobs instead of blocking, on the main thread
+// too. Job slots come from fixed per-thread pools: spawning never allocates,
+// and a full pool or deque runs the job inline. Long blocking work (file I/O,
+// the texture loader, capture writers) keeps its own threads.
+#define JOB_MAX_THREADS 16
+#define JOB_DEQUE_SIZE 4096         // power of two
+#define JOB_POOL_SIZE 4096
+#define JOB_SPIN 64                 // failed steal rounds before a worker sleeps
+
+typedef void (*JobFn)(int index, void* ctx);
+struct JobCounter;
+struct Job {
+    JobFn fn; void* ctx;
+    int begin, end, grain;
+    JobCounter* done;               // decremented when the job (not its split-off halves) finishes
+    Job* next;                      // in a counter's list of dependents
+    std::atomic<bool> free{ true };
+};
+struct JobCounter {
+    std::atomic<int> pending{ 0 };
+    std::atomic<int> touching{ 0 };  // finishers still using the counter
+    std::mutex mtx;                 // guards waiting
+    Job* waiting = nullptr;         // spawned after this counter, released at zero
+};
+
+struct JobDeque {
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Job*> buf[JOB_DEQUE_SIZE];
+
+    bool push(Job* j) {             // owner only
+        int64_t b = bottom.load(std::memory_order_relaxed), t = top.load(std::memory_order_acquire);
+        if (b - t >= JOB_DEQUE_SIZE) return false;
+        buf[b & (JOB_DEQUE_SIZE - 1)].store(j, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);     // publishes the job to thieves
+        return true;
+    }
+    Job* pop() {                    // owner only, newest first
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) { bottom.store(b + 1, std::memory_order_relaxed); return nullptr; }
+        Job* j = buf[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+        if (t == b) {               // last one: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) j = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return j;
+    }
+    bool empty() const {            // owner only
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_acquire);
+    }
+    Job* steal() {                  // any thread, oldest first
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        Job* j = buf[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+        return j;
+    }
+};
+
+struct JobThread {
+    JobDeque queue;
+    Job pool[JOB_POOL_SIZE];
+    unsigned nextSlot = 0;
+    unsigned rng = 0;
+};
+struct JobSystem {
+    JobThread slot[JOB_MAX_THREADS];    // 0 is the main thread
+    std::vector<std::thread> threads;
+    int count = 1;                      // participating threads
+    std::atomic<int> queued{ 0 }, sleeping{ 0 };
+    std::atomic<bool> quit{ false };
+    std::mutex mtx;
+    std::condition_variable wake;
+};
+JobSystem g_jobs;
+static thread_local int t_jobThread = -1;
+
+static Job* jobAlloc() {
+    JobThread& T = g_jobs.slot[t_jobThread];
+    for (int n = 0; n < JOB_POOL_SIZE; ++n) {
+        Job* j = &T.pool[T.nextSlot++ & (JOB_POOL_SIZE - 1)];
+        if (j->free.load(std::memory_order_acquire)) { j->free.store(false, std::memory_order_relaxed); return j; }
+    }
+    return nullptr;
+}
+
+// onto the calling thread's deque; wakes a sleeper if there is one
+static bool jobPush(Job* j) {
+    if (!g_jobs.slot[t_jobThread].queue.push(j)) return false;
+    g_jobs.queued.fetch_add(1);
+    if (g_jobs.sleeping.load()) {
+        { std::lock_guard<std::mutex> lk(g_jobs.mtx); }
+        g_jobs.wake.notify_one();
+    }
+    return true;
+}
+static void jobExecute(Job* j);
+static void jobEnqueue(Job* j) {
+    if (!jobPush(j)) jobExecute(j);     // deque full
+}
+
+static void jobFinish(Job* j) {
+    JobCounter* c = j->done;
+    j->free.store(true, std::memory_order_release);
+    if (!c) return;
+    c->touching.fetch_add(1);
+    if (c->pending.fetch_sub(1) == 1) {
+        Job* list;
+        {
+            std::lock_guard<std::mutex> lk(c->mtx);
+            list = c->waiting; c->waiting = nullptr;
+        }
+        while (list) { Job* n = list->next; jobEnqueue(list); list = n; }
+    }
+    c->touching.fetch_sub(1);
+}
+
+// the upper half of [mid, end) as its own job; false if there is no room
+static bool jobSplit(const Job* j, int mid, int end) {
+    Job* s = jobAlloc();
+    if (!s) return false;
+    s->fn = j->fn; s->ctx = j->ctx; s->begin = mid; s->end = end; s->grain = j->grain; s->done = j->done; s->next = nullptr;
+    if (s->done) s->done->pending.fetch_add(1);
+    if (jobPush(s)) return true;
+    if (s->done) s->done->pending.fetch_sub(1);
+    s->free.store(true, std::memory_order_release);
+    return false;
+}
+
+// splits only while nothing of ours is waiting to be stolen
+static void jobExecute(Job* j) {
+    const JobDeque& q = g_jobs.slot[t_jobThread].queue;
+    int b = j->begin, e = j->end;
+    while (b < e) {
+        int mid = b + (e - b) / 2;
+        if (e - b > j->grain && q.empty() && jobSplit(j, mid, e)) e = mid;
+        for (int stop = std::min(e, b + j->grain); b < stop; ++b) j->fn(b, j->ctx);
+    }
+    jobFinish(j);
+}
+
+// own deque first, then steal starting from a random victim
+static Job* jobFind() {
+    JobThread& T = g_jobs.slot[t_jobThread];
+    Job* j = T.queue.pop();
+    if (!j) {
+        T.rng = T.rng * 1664525u + 1013904223u;
+        for (int k = 0, v = (int)(T.rng >> 16) % g_jobs.count; k < g_jobs.count && !j; ++k, v = (v + 1) % g_jobs.count)
+            if (v != t_jobThread) j = g_jobs.slot[v].queue.steal();
+    }
+    if (j) g_jobs.queued.fetch_sub(1);
+    return j;
+}
+
+static void jobWorkerLoop(int index) {
+    PROFILE_THREAD("worker");
+    t_jobThread = index;
+    int idle = 0;
+    while (!g_jobs.quit.load(std::memory_order_relaxed)) {
+        if (Job* j = jobFind()) { jobExecute(j); idle = 0; continue; }
+        if (++idle < JOB_SPIN) { std::this_thread::yield(); continue; }
+        std::unique_lock<std::mutex> lk(g_jobs.mtx);
+        g_jobs.sleeping.fetch_add(1);
+        g_jobs.wake.wait(lk, [] { return g_jobs.quit.load() || g_jobs.queued.load() > 0; });
+        g_jobs.sleeping.fetch_sub(1);
+        idle = 0;
+    }
+}
+
+// main thread; workers = 0 runs every job on the caller
+void jobStart(int workers) {
+    workers = std::max(0, std::min(workers, JOB_MAX_THREADS - 1));
+    t_jobThread = 0;
+    g_jobs.quit = false;
+    g_jobs.count = workers + 1;
+    for (int i = 1; i <= workers; ++i) g_jobs.threads.emplace_back(jobWorkerLoop, i);
+}
+void jobStop() {
+    { std::lock_guard<std::mutex> lk(g_jobs.mtx); g_jobs.quit = true; }
+    g_jobs.wake.notify_all();
+    for (auto& t : g_jobs.threads) t.join();
+    g_jobs.threads.clear();
+    g_jobs.count = 1;
+}
+
+// runs queued jobs until the counter drains
+void jobWait(JobCounter& c) {
+    while (c.pending.load(std::memory_order_acquire) > 0 || c.touching.load(std::memory_order_acquire) > 0) {
+        Job* j = t_jobThread >= 0 ? jobFind() : nullptr;
+        if (j) jobExecute(j);
+        else std::this_thread::yield();
+    }
+}
+
+// fn(i, ctx) for i in [0, count), split down to `grain` items per job; runs
+// inline when called from a thread outside the system
+void jobSpawn(JobFn fn, void* ctx, int count, int grain, JobCounter* done, JobCounter* after = nullptr) {
+    Job* j = t_jobThread >= 0 ? jobAlloc() : nullptr;
+    if (!j) {
+        if (after) jobWait(*after);
+        for (int i = 0; i < count; ++i) fn(i, ctx);
+        return;
+    }
+    j->fn = fn; j->ctx = ctx; j->begin = 0; j->end = count; j->grain = std::max(grain, 1); j->done = done; j->next = nullptr;
+    if (done) done->pending.fetch_add(1);
+    if (after) {
+        std::lock_guard<std::mutex> lk(after->mtx);
+        if (after->pending.load() > 0) { j->next = after->waiting; after->waiting = j; return; }
+    }
+    jobEnqueue(j);
+}
+
+// about eight jobs per thread unless the caller knows better
+void jobParallelFor(int count, JobFn fn, void* ctx, int grain = 0) {
+    if (count <= 0) return;
+    if (grain <= 0) grain = std::max(1, count / (g_jobs.count * 8));
+    if (count <= grain || g_jobs.count == 1) { for (int i = 0; i < count; ++i) fn(i, ctx); return; }
+    JobCounter done;
+    jobSpawn(fn, ctx, count, grain, &done);
+    jobWait(done);
+}
+
+// ---------------- Frame arena ----------------
+// Linear allocator for data that lives for one frame: draw lists, visible
+// lists, sort keys, scratch copies. There is one arena per frame in flight;
+// frameArenaBegin() resets the next one in O(1), so the previous frame's
+// allocations stay valid while this one is built. An allocation that does not
+// fit spills to malloc and the arena grows to the frame's peak at its next
+// reset. Main thread only.
+#define FRAME_ARENAS 2
+#define FRAME_ARENA_BYTES (256 * 1024)
+
+struct ArenaSpill { ArenaSpill* next; };
+struct FrameArena {
+    unsigned char* base = nullptr;
+    size_t cap = 0, used = 0, spilled = 0;
+    ArenaSpill* spills = nullptr;
+};
+FrameArena g_frameArenas[FRAME_ARENAS];
+FrameArena* g_frameArena = &g_frameArenas[0];
+unsigned g_frameArenaIndex = 0;
+size_t g_frameArenaPeak = 0;        // largest frame so far, bytes
+int g_frameArenaSpills = 0;         // frames that outgrew their arena
+
+static void* frameAllocBytes(size_t n, size_t align) {
+    FrameArena& a = *g_frameArena;
+    size_t at = ((uintptr_t)a.base + a.used + align - 1) / align * align - (uintptr_t)a.base;
+    if (at + n <= a.cap) { a.used = at + n; return a.base + at; }
+    ArenaSpill* s = (ArenaSpill*)malloc(sizeof(ArenaSpill) + n + align);
+    s->next = a.spills; a.spills = s;
+    a.spilled += n + align;
+    return (void*)(((uintptr_t)(s + 1) + align - 1) / align * align);
+}
+// uninitialized storage for n objects of a trivially destructible type
+template <typename T> static T* frameAlloc(size_t n) {
+    return (T*)frameAllocBytes(n * sizeof(T), alignof(T));
+}
+
+void frameArenaBegin() {
+    g_frameArenaIndex = (g_frameArenaIndex + 1) % FRAME_ARENAS;
+    FrameArena& a = g_frameArenas[g_frameArenaIndex];
+    g_frameArena = &a;
+    size_t need = std::max<size_t>(a.used + a.spilled, FRAME_ARENA_BYTES);
+    g_frameArenaPeak = std::max(g_frameArenaPeak, a.used + a.spilled);
+    if (a.spilled) g_frameArenaSpills++;
+    while (a.spills) { ArenaSpill* s = a.spills; a.spills = s->next; free(s); }
+    if (need > a.cap) {
+        free(a.base);
+        a.cap = std::max(need, a.cap * 2);
+        a.base = (unsigned char*)malloc(a.cap);
+    }
+    a.used = a.spilled = 0;
+}
+
+// ---------------- Heap allocation check (debug builds) ----------------
+// Counts operator new calls made by the main thread. Once the frame loop has
+// settled, a frame that allocates from the general heap trips an assert:
+// per-frame data belongs in the frame arena. Events that (re)build resources
+// -- key presses, resizes, texture uploads, captures -- call
+// ALLOC_CHECK_SETTLE() to exempt the next few frames. Worker, loader and
+// capture threads are not counted. -DNDEBUG compiles it out.
+#ifndef NDEBUG
+#define ALLOC_SETTLE_FRAMES 60
+static thread_local int t_heapAllocs = 0;
+int g_heapAllocsLast = 0;           // main thread, last frame
+int g_allocSettle = ALLOC_SETTLE_FRAMES;
+
+void* operator new(size_t n) {
+    ++t_heapAllocs;
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t n) { return operator new(n); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"   // it pairs with the malloc above
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static void allocCheckEndFrame() {
+    g_heapAllocsLast = t_heapAllocs;
+    t_heapAllocs = 0;
+    if (g_allocSettle > 0) { --g_allocSettle; return; }
+    if (g_heapAllocsLast) {
+        printf("Heap check: %d allocation(s) in a steady-state frame\n", g_heapAllocsLast);
+        assert(g_heapAllocsLast == 0);
+    }
+}
+#define ALLOC_CHECK_SETTLE() (g_allocSettle = ALLOC_SETTLE_FRAMES)
+#define ALLOC_CHECK_END_FRAME() allocCheckEndFrame()
+#else
+#define ALLOC_CHECK_SETTLE() ((void)0)
+#define ALLOC_CHECK_END_FRAME() ((void)0)
+#endif
+
 // ---------------- Text overlay ----------------
+void displayStats(float x, float y, float lh, void* font);
 void renderBitmapString(float x, float y, void* font, const char* s) {
     glRasterPos2f(x, y);
     while (*s) glutBitmapCharacter(font, *s++);
 }
 void displayLabel() {
+    DRAW_SCOPE();
     glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity();
     gluOrtho2D(0, win_width, 0, win_height);
     glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
@@ -95,8 +943,10 @@ void displayLabel() {
     glColor3f(1.0f, 1.0f, 0.85f);
     void* font = GLUT_BITMAP_8_BY_13;
     float x = 10.0f, y = win_height - 18.0f, lh = 16.0f;
-    renderBitmapString(x, y, font, "W/S: forward/back  A/D: strafe  Q/E: up/down  Arrow: look  Shift: faster");
-    renderBitmapString(x, y -= lh, font, "P: persp/ortho  Z/X: zoom  M: anim  T: axes  R: reset  ESC: quit");
+    renderBitmapString(x, y, font, "W/S: forward/back  A/D: strafe  Q/E: up/down  Arrow: look  Tab: mouse look  Shift: faster");
+    renderBitmapString(x, y -= lh, font, "P: persp/ortho  Z/X: zoom  M: anim  T: axes  R: reset  I: stats  O: occlusion  L: LOD  C/V: capture  G: dyn-res  B/N: post  F: fog  K: batch  J: GPU-driven  H: late latch  U: on-demand  ESC: quit");
+
+    if (showStats) displayStats(x, y - lh, lh, font);
 
     glEnable(GL_LIGHTING); glEnable(GL_DEPTH_TEST);
     glMatrixMode(GL_PROJECTION); glPopMatrix();
@@ -106,6 +956,7 @@ void displayLabel() {
 // ---------------- Axes ----------------
 void axes() {
     if (!showAxes) return;
+    DRAW_SCOPE();
     glDisable(GL_LIGHTING);
     glBegin(GL_LINES);
     glColor3f(1, 0, 0); glVertex3f(0, 0, 0); glVertex3f(2, 0, 0);
@@ -115,11 +966,161 @@ void axes() {
     glEnable(GL_LIGHTING);
 }
 
+// ---------------- Meshes (pre-tessellated, LOD) ----------------
+// GLUT/GLU primitives are tessellated once at startup into buffer objects.
+// Spheres and tori keep several detail levels, picked per draw by the
+// projected tessellation error.
+struct MeshVertex { float px, py, pz, nx, ny, nz, u, v; };
+struct Mesh { GLuint vbo, ibo; int indexCount; float err; }; // err: max chord error at unit scale
+
+#define SPHERE_LODS 6
+#define TORUS_LODS 4
+const int kSphereLod[SPHERE_LODS][2] = { { 64, 64 }, { 32, 32 }, { 24, 24 }, { 14, 12 }, { 8, 6 }, { 6, 4 } }; // slices, stacks
+const int kTorusLod[TORUS_LODS][2] = { { 24, 48 }, { 12, 24 }, { 6, 12 }, { 3, 6 } };                      // sides, rings
+Mesh g_sphereMesh[SPHERE_LODS];  // unit radius, GLU layout (poles on Z, GLU texcoords)
+Mesh g_torusMesh[TORUS_LODS];    // glutSolidTorus(0.025, 0.16) layout (ring in the XY plane)
+Mesh g_cubeMesh;                 // glutSolidCube(1)
+float g_lodErrorPx = 0.75f;      // allowed tessellation error on screen
+int g_meshTris = 0;              // triangles submitted through drawMesh this frame
+
+struct MeshData { std::vector<MeshVertex> v; std::vector<GLushort> idx; float err; };
+
+static Mesh uploadMesh(const MeshData& d) {
+    const std::vector<MeshVertex>& v = d.v;
+    const std::vector<GLushort>& idx = d.idx;
+    Mesh m = { 0, 0, (int)idx.size(), d.err };
+    glGenBuffers(1, &m.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glBufferData(GL_ARRAY_BUFFER, v.size() * sizeof(MeshVertex), v.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &m.ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(GLushort), idx.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return m;
+}
+
+static MeshData tessellateSphere(int slices, int stacks) {
+    const float PI = 3.14159265f;
+    MeshData d;
+    std::vector<MeshVertex>& v = d.v;
+    std::vector<GLushort>& idx = d.idx;
+    for (int j = 0; j <= stacks; ++j) {
+        float rho = PI * j / stacks;
+        for (int i = 0; i <= slices; ++i) {
+            float theta = 2.0f * PI * i / slices;
+            float x = sinf(theta) * sinf(rho), y = cosf(theta) * sinf(rho), z = cosf(rho);
+            MeshVertex mv = { x, y, z, x, y, z, 1.0f - (float)i / slices, 1.0f - (float)j / stacks };
+            v.push_back(mv);
+        }
+    }
+    for (int j = 0; j < stacks; ++j)
+        for (int i = 0; i < slices; ++i) {
+            GLushort a = (GLushort)(j * (slices + 1) + i), b = (GLushort)(a + slices + 1);
+            if (j != 0) { idx.push_back(a); idx.push_back(b); idx.push_back(a + 1); }
+            if (j != stacks - 1) { idx.push_back(a + 1); idx.push_back(b); idx.push_back(b + 1); }
+        }
+    d.err = fmaxf(1.0f - cosf(PI / slices), 1.0f - cosf(PI / (2 * stacks)));
+    return d;
+}
+
+static MeshData tessellateTorus(float r, float R, int sides, int rings) {
+    const float PI = 3.14159265f;
+    MeshData d;
+    std::vector<MeshVertex>& v = d.v;
+    std::vector<GLushort>& idx = d.idx;
+    for (int i = 0; i <= rings; ++i) {
+        float phi = 2.0f * PI * i / rings;
+        for (int j = 0; j <= sides; ++j) {
+            float theta = 2.0f * PI * j / sides;
+            float nx = cosf(theta) * cosf(phi), ny = cosf(theta) * sinf(phi), nz = sinf(theta);
+            MeshVertex mv = { R * cosf(phi) + r * nx, R * sinf(phi) + r * ny, r * nz, nx, ny, nz,
+                (float)i / rings, (float)j / sides };
+            v.push_back(mv);
+        }
+    }
+    for (int i = 0; i < rings; ++i)
+        for (int j = 0; j < sides; ++j) {
+            GLushort a = (GLushort)(i * (sides + 1) + j), b = (GLushort)(a + sides + 1);
+            idx.push_back(a); idx.push_back(b); idx.push_back(a + 1);
+            idx.push_back(a + 1); idx.push_back(b); idx.push_back(b + 1);
+        }
+    d.err = fmaxf(r * (1.0f - cosf(PI / sides)), (R + r) * (1.0f - cosf(PI / rings)));
+    return d;
+}
+
+static MeshData tessellateCube() {
+    static const float n[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    MeshData d;
+    std::vector<MeshVertex>& v = d.v;
+    std::vector<GLushort>& idx = d.idx;
+    for (int f = 0; f < 6; ++f) {
+        // two tangent axes for the face (u must not be parallel to n)
+        float ux = n[f][0] != 0 ? 0.0f : 1.0f, uy = 0.0f, uz = n[f][0] != 0 ? 1.0f : 0.0f;
+        float wx, wy, wz;
+        cross3(n[f][0], n[f][1], n[f][2], ux, uy, uz, &wx, &wy, &wz);
+        GLushort base = (GLushort)v.size();
+        for (int k = 0; k < 4; ++k) {
+            float su = (k == 1 || k == 2) ? 0.5f : -0.5f, sw = (k >= 2) ? 0.5f : -0.5f;
+            MeshVertex mv = { n[f][0] * 0.5f + ux * su + wx * sw, n[f][1] * 0.5f + uy * su + wy * sw,
+                n[f][2] * 0.5f + uz * su + wz * sw, n[f][0], n[f][1], n[f][2], su + 0.5f, sw + 0.5f };
+            v.push_back(mv);
+        }
+        const GLushort q[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int k = 0; k < 6; ++k) idx.push_back(base + q[k]);
+    }
+    d.err = 0.0f;
+    return d;
+}
+
+void buildMeshes() {
+    for (int i = 0; i < SPHERE_LODS; ++i) g_sphereMesh[i] = uploadMesh(tessellateSphere(kSphereLod[i][0], kSphereLod[i][1]));
+    for (int i = 0; i < TORUS_LODS; ++i) g_torusMesh[i] = uploadMesh(tessellateTorus(0.025f, 0.16f, kTorusLod[i][0], kTorusLod[i][1]));
+    g_cubeMesh = uploadMesh(tessellateCube());
+}
+
+static void drawMesh(const Mesh& m) {
+    PROFILE_FUNCTION();
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(MeshVertex), (const void*)0);
+    glNormalPointer(GL_FLOAT, sizeof(MeshVertex), (const void*)(3 * sizeof(float)));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(MeshVertex), (const void*)(6 * sizeof(float)));
+    glDrawElements(GL_TRIANGLES, m.indexCount, GL_UNSIGNED_SHORT, (const void*)0);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    g_meshTris += m.indexCount / 3;
+}
+
+// screen pixels covered by one world unit at the given world position
+static float pixelsPerUnit(float x, float y, float z) {
+    if (!use_perspective) return win_height / (2.0f * ortho_scale);
+    float d = (x - eyeX) * fwdX + (y - eyeY) * fwdY + (z - eyeZ) * fwdZ; // view depth
+    if (d < z_near) d = z_near;
+    return win_height / (2.0f * tanf(fovy * 0.5f * DEG2RAD) * d);
+}
+// coarsest level in [finest, count) whose error stays under g_lodErrorPx
+static int selectLod(const Mesh* lods, int finest, int count, float scale, float ppu) {
+    if (!lod_on) return finest;
+    int pick = finest;
+    for (int i = finest; i < count; ++i)
+        if (lods[i].err * scale * ppu <= g_lodErrorPx) pick = i;
+    return pick;
+}
+
 // ---------------- Primitive helpers ----------------
 static void drawBox(float sx, float sy, float sz) {
-    glPushMatrix(); glScalef(sx, sy, sz); glutSolidCube(1.0f); glPopMatrix();
+    PROFILE_FUNCTION();
+    glPushMatrix(); glScalef(sx, sy, sz); drawMesh(g_cubeMesh); glPopMatrix();
 }
 static void drawTexturedBox(float sx, float sy, float sz, float tileU, float tileV) {
+    PROFILE_FUNCTION();
     float hx = sx * 0.5f, hy = sy * 0.5f, hz = sz * 0.5f;
     glBegin(GL_QUADS);
     // +X
@@ -161,8 +1162,85 @@ static void drawTexturedBox(float sx, float sy, float sz, float tileU, float til
     glEnd();
 }
 
+// ---------------- Transform hierarchy ----------------
+// Scene nodes in structure-of-arrays form: parent index, local and world
+// matrices, and a dirty flag set when a local transform is edited. The
+// update is one linear pass over the nodes in depth order that recomputes
+// a world matrix only when its local matrix changed or its parent's world
+// moved; when nothing was edited the pass is skipped outright.
+struct TransformSoA {
+    std::vector<int> parent, depth;
+    std::vector<float> local, world;        // 16 floats per node, column-major
+    std::vector<unsigned char> dirty;       // local edited since the last update
+    std::vector<unsigned char> moved;       // world recomputed by the last update
+    std::vector<int> order;                 // node indices sorted by depth
+    int anyDirty, orderValid;
+    int updated;                            // nodes recomputed by the last update
+};
+TransformSoA g_xform;
+
+int xformCreate(int parent) {
+    TransformSoA& x = g_xform;
+    int n = (int)x.parent.size();
+    x.parent.push_back(parent);
+    x.depth.push_back(parent >= 0 ? x.depth[parent] + 1 : 0);
+    x.local.resize(x.local.size() + 16);
+    x.world.resize(x.world.size() + 16);
+    mat4Identity(&x.local[n * 16]);
+    x.dirty.push_back(1);
+    x.moved.push_back(0);
+    x.anyDirty = 1;
+    x.orderValid = 0;
+    return n;
+}
+
+// local matrix for writing; marks the node dirty
+float* xformEdit(int n) {
+    g_xform.dirty[n] = 1;
+    g_xform.anyDirty = 1;
+    return &g_xform.local[n * 16];
+}
+
+const float* xformWorld(int n) { return &g_xform.world[n * 16]; }
+
+void xformUpdate() {
+    TransformSoA& x = g_xform;
+    x.updated = 0;
+    if (!x.anyDirty) return;
+    PROFILE_FUNCTION();
+    int count = (int)x.parent.size();
+    if (!x.orderValid) {   // counting sort by depth; stable, so siblings keep creation order
+        int maxDepth = 0;
+        for (int d : x.depth) maxDepth = d > maxDepth ? d : maxDepth;
+        std::vector<int> start(maxDepth + 2, 0);
+        for (int d : x.depth) ++start[d + 1];
+        for (int d = 1; d <= maxDepth + 1; ++d) start[d] += start[d - 1];
+        x.order.resize(count);
+        for (int n = 0; n < count; ++n) x.order[start[x.depth[n]]++] = n;
+        x.orderValid = 1;
+    }
+    for (int i = 0; i < count; ++i) {
+        int n = x.order[i], p = x.parent[n];
+        int recompute = x.dirty[n] || (p >= 0 && x.moved[p]);
+        x.moved[n] = (unsigned char)recompute;
+        x.dirty[n] = 0;
+        if (!recompute) continue;
+        if (p >= 0) mat4Mul(&x.world[n * 16], &x.world[p * 16], &x.local[n * 16]);
+        else memcpy(&x.world[n * 16], &x.local[n * 16], 16 * sizeof(float));
+        ++x.updated;
+    }
+    x.anyDirty = 0;
+}
+
+// the room's nodes, created in this order by buildSceneTransforms()
+enum { XF_TABLE, XF_CHAIR0, XF_EARTH = XF_CHAIR0 + 4, XF_LAMP, XF_CORD, XF_BULB, XF_BULB_MESH, XF_SHADE, XF_COUNT };
+
 // ---------------- Room (textured floor/walls/ceiling + painting) ----------------
+const float kFloorTile = 8.0f, kCeilTile = 4.0f, kWallTileU = 4.0f, kWallTileV = 2.0f;
+const float kPaintingW = 1.4f, kPaintingH = 0.9f, kPaintingY = 1.6f, kPaintingFrame = 0.03f;
+
 void drawRoom() {
+    DRAW_SCOPE();
     const float x0 = -ROOM_W * 0.5f, x1 = ROOM_W * 0.5f;
     const float z0 = -ROOM_D * 0.5f, z1 = ROOM_D * 0.5f;
     const float y0 = 0.0f, y1 = ROOM_H;
@@ -175,7 +1253,7 @@ void drawRoom() {
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, texFloor);
     }
-    float tile = 8.0f;
+    float tile = kFloorTile;
     glBegin(GL_QUADS);
     glNormal3f(0, 1, 0);
 
@@ -200,7 +1278,7 @@ void drawRoom() {
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, texCeil);
     }
-    float ceilU = 4.0f, ceilV = 4.0f;
+    float ceilU = kCeilTile, ceilV = kCeilTile;
     glBegin(GL_QUADS);
     glNormal3f(0, -1, 0);
 
@@ -225,7 +1303,7 @@ void drawRoom() {
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, texWall);
     }
-    float wallU = 4.0f, wallV = 2.0f;
+    float wallU = kWallTileU, wallV = kWallTileV;
     glBegin(GL_QUADS);
 
     // +X wall
@@ -280,7 +1358,7 @@ void drawRoom() {
 
     // Painting on -Z wall
     if (texPainting) {
-        float pw = 1.4f, ph = 0.9f, z = z0 + 0.001f, y = 1.6f;
+        float pw = kPaintingW, ph = kPaintingH, z = z0 + 0.001f, y = kPaintingY;
         glEnable(GL_TEXTURE_2D);
         glBindTexture(GL_TEXTURE_2D, texPainting);
         glColor3f(1, 1, 1);
@@ -296,7 +1374,7 @@ void drawRoom() {
 
         // frame
         glColor3f(0.25f, 0.15f, 0.08f);
-        float t = 0.03f;
+        float t = kPaintingFrame;
         glBegin(GL_QUADS);
         // bottom
         glVertex3f(-pw * 0.5f - t, y - ph * 0.5f - t, z);
@@ -323,10 +1401,15 @@ void drawRoom() {
 }
 
 // ---------------- Furniture (table + textured chairs) ----------------
+const float kTableTopW = 1.20f, kTableTopD = 0.80f, kTableTopT = 0.08f, kTableHeight = 0.75f, kTableLegT = 0.08f;
+const float kChairSeatW = 0.45f, kChairSeatD = 0.45f, kChairSeatT = 0.06f, kChairSeatH = 0.45f;
+const float kChairLegT = 0.06f, kChairBackH = 0.45f;
+
 void drawTable() {
-    const float topW = 1.20f, topD = 0.80f, topT = 0.08f;
-    const float height = 0.75f;
-    const float legT = 0.08f;
+    DRAW_SCOPE();
+    const float topW = kTableTopW, topD = kTableTopD, topT = kTableTopT;
+    const float height = kTableHeight;
+    const float legT = kTableLegT;
     const float legH = height - topT * 0.5f;
 
     // top
@@ -360,10 +1443,11 @@ void drawTable() {
 }
 
 void drawChair() {
-    const float seatW = 0.45f, seatD = 0.45f, seatT = 0.06f;
-    const float seatH = 0.45f;
-    const float legT = 0.06f;
-    const float backH = 0.45f;
+    DRAW_SCOPE();
+    const float seatW = kChairSeatW, seatD = kChairSeatD, seatT = kChairSeatT;
+    const float seatH = kChairSeatH;
+    const float legT = kChairLegT;
+    const float backH = kChairBackH;
 
     if (texWood) { glEnable(GL_TEXTURE_2D); glBindTexture(GL_TEXTURE_2D, texWood); glColor3f(1, 1, 1); }
     else { glColor3f(0.60f, 0.36f, 0.22f); }
@@ -400,23 +1484,25 @@ void drawChair() {
     if (texWood) { glBindTexture(GL_TEXTURE_2D, 0); glDisable(GL_TEXTURE_2D); }
 }
 
-// Earth (textured GLU sphere)
+// Earth (textured sphere, GLU layout)
+int g_earthLod = 0;
 void drawTexturedEarth(float radius) {
+    DRAW_SCOPE();
     if (!texEarth) return;
     glEnable(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, texEarth);
 
-    GLUquadric* quad = gluNewQuadric();
-    gluQuadricTexture(quad, GL_TRUE);
-    gluQuadricNormals(quad, GLU_SMOOTH);
+    const SceneObject& o = g_objects[OBJ_EARTH];
+    float ppu = pixelsPerUnit((o.bmin[0] + o.bmax[0]) * 0.5f, (o.bmin[1] + o.bmax[1]) * 0.5f, (o.bmin[2] + o.bmax[2]) * 0.5f);
+    g_earthLod = selectLod(g_sphereMesh, 0, SPHERE_LODS, radius, ppu);
 
     glColor3f(1, 1, 1);
     glPushMatrix();
-    glRotatef(earthAngle, 0, 1, 0);
-    gluSphere(quad, radius, 64, 64);
+    glMultMatrixf(xformWorld(XF_EARTH));
+    glScalef(radius, radius, radius);
+    drawMesh(g_sphereMesh[g_earthLod]);
     glPopMatrix();
 
-    gluDeleteQuadric(quad);
     glBindTexture(GL_TEXTURE_2D, 0);
     glDisable(GL_TEXTURE_2D);
 }
@@ -434,41 +1520,207 @@ float computeFlicker(float t) {
     return clampf(base * drop, 0.15f, 1.0f);
 }
 
-void drawBulbLampAndLight() {
-    const float anchorY = ROOM_H - 0.05f;
-    const float cordLen = 0.28f;
+// ---------------- Light animation (flicker kernel) ----------------
+// Every bulb in the scene runs computeFlicker's curve with its own phase,
+// dip-hash seed and style. Lights are stored as parallel arrays so the kernel
+// evaluates eight per step with AVX2, or four with the SSE2 every x86-64 CPU
+// has: sin is a range-reduced polynomial and the dip hash is the same
+// fract(sin * 125), so a steady light with zero phase and seed tracks
+// computeFlicker (light 0 is the room's bulb).
+enum { FLICKER_STEADY, FLICKER_DYING, FLICKER_STROBE, FLICKER_STYLES };
+struct FlickerStyle { float base, amp, dipChance, dipLevel, strobe, floor; };
+const FlickerStyle kFlickerStyle[FLICKER_STYLES] = {
+    { 0.75f, 0.25f, 0.035f, 0.35f, 0.0f, 0.15f },  // steady: computeFlicker
+    { 0.40f, 0.30f, 0.300f, 0.10f, 0.0f, 0.02f },  // dying: dim, cuts out often
+    { 0.75f, 0.25f, 0.000f, 1.00f, 1.0f, 0.05f },  // strobe: square wave
+};
+const float kStrobeRate = 21.0f;   // rad/s, ~3.3 Hz
+
+struct LightAnimSoA {
+    std::vector<float> phase, seed, base, amp, dipChance, dipLevel, strobe, floor, out;
+    int count() const { return (int)out.size(); }
+    void clear() { *this = LightAnimSoA(); }
+    int add(int style, float ph, float sd) {
+        const FlickerStyle& s = kFlickerStyle[style];
+        phase.push_back(ph); seed.push_back(sd);
+        base.push_back(s.base); amp.push_back(s.amp);
+        dipChance.push_back(s.dipChance); dipLevel.push_back(s.dipLevel);
+        strobe.push_back(s.strobe); floor.push_back(s.floor);
+        out.push_back(1.0f);
+        return count() - 1;
+    }
+};
+LightAnimSoA g_lightAnim;
+
+// sin(x): Cody-Waite reduction to [-pi, pi] (2*pi split in three so k*C1 is
+// exact), fold to [-pi/2, pi/2], then the degree-11 Taylor polynomial
+// (|err| < 1e-7). Stays accurate for the hash's 47*t argument over hours.
+const float kInv2Pi = 0.159154937f, kTwoPiC1 = 6.28125f, kTwoPiC2 = 1.93530717e-3f, kTwoPiC3 = 1.02531317e-11f;
+const float kSinC3 = -1.66666667e-1f, kSinC5 = 8.33333333e-3f, kSinC7 = -1.98412698e-4f,
+    kSinC9 = 2.75573192e-6f, kSinC11 = -2.50521084e-8f;
+
+static inline float flickerSin(float x) {
+    float k = floorf(x * kInv2Pi + 0.5f);
+    float r = ((x - k * kTwoPiC1) - k * kTwoPiC2) - k * kTwoPiC3;
+    float a = fminf(fabsf(r), 3.14159265f - fabsf(r)), a2 = a * a;
+    float p = a * (1.0f + a2 * (kSinC3 + a2 * (kSinC5 + a2 * (kSinC7 + a2 * (kSinC9 + a2 * kSinC11)))));
+    return r < 0.0f ? -p : p;
+}
+
+static void flickerScalar(LightAnimSoA& L, float t, int i0, int i1) {
+    for (int i = i0; i < i1; ++i) {
+        float tt = t + L.phase[i];
+        float s = 0.5f * flickerSin(3.5f * tt) + flickerSin(6.5f * tt + 1.3f);
+        float v = L.base[i] + L.amp[i] * s;
+        float sq = flickerSin(kStrobeRate * tt) >= 0.0f ? 1.0f : 0.0f;
+        v += L.strobe[i] * (sq - v);
+        if (fractf(flickerSin(47.0f * tt + L.seed[i]) * 125.0f) < L.dipChance[i]) v *= L.dipLevel[i];
+        L.out[i] = clampf(v, L.floor[i], 1.0f);
+    }
+}
+
+#if defined(__AVX2__)
+static inline __m256 flickerSin8(__m256 x) {
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    __m256 k = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(kInv2Pi)), _mm256_set1_ps(0.5f)));
+    __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(k, _mm256_set1_ps(kTwoPiC1)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(kTwoPiC2)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(kTwoPiC3)));
+    __m256 a = _mm256_andnot_ps(signBit, r);
+    a = _mm256_min_ps(a, _mm256_sub_ps(_mm256_set1_ps(3.14159265f), a));
+    __m256 a2 = _mm256_mul_ps(a, a);
+    __m256 p = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kSinC11), a2), _mm256_set1_ps(kSinC9));
+    p = _mm256_add_ps(_mm256_mul_ps(p, a2), _mm256_set1_ps(kSinC7));
+    p = _mm256_add_ps(_mm256_mul_ps(p, a2), _mm256_set1_ps(kSinC5));
+    p = _mm256_add_ps(_mm256_mul_ps(p, a2), _mm256_set1_ps(kSinC3));
+    p = _mm256_add_ps(_mm256_mul_ps(p, a2), _mm256_set1_ps(1.0f));
+    return _mm256_xor_ps(_mm256_mul_ps(p, a), _mm256_and_ps(r, signBit));
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+// SSE2 has no floor or blend: truncate and step down where that rounded up
+static inline __m128 flickerFloor4(__m128 x) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+static inline __m128 flickerSin4(__m128 x) {
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    __m128 k = flickerFloor4(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(kInv2Pi)), _mm_set1_ps(0.5f)));
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(kTwoPiC1)));
+    r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(kTwoPiC2)));
+    r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(kTwoPiC3)));
+    __m128 a = _mm_andnot_ps(signBit, r);
+    a = _mm_min_ps(a, _mm_sub_ps(_mm_set1_ps(3.14159265f), a));
+    __m128 a2 = _mm_mul_ps(a, a);
+    __m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(kSinC11), a2), _mm_set1_ps(kSinC9));
+    p = _mm_add_ps(_mm_mul_ps(p, a2), _mm_set1_ps(kSinC7));
+    p = _mm_add_ps(_mm_mul_ps(p, a2), _mm_set1_ps(kSinC5));
+    p = _mm_add_ps(_mm_mul_ps(p, a2), _mm_set1_ps(kSinC3));
+    p = _mm_add_ps(_mm_mul_ps(p, a2), _mm_set1_ps(1.0f));
+    return _mm_xor_ps(_mm_mul_ps(p, a), _mm_and_ps(r, signBit));
+}
+#endif
+
+// writes L.out for every light at time t
+void flickerEvaluate(LightAnimSoA& L, float t) {
+    int i = 0, n = L.count();
+#if defined(__AVX2__)
+    const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m256 tt = _mm256_add_ps(_mm256_set1_ps(t), _mm256_loadu_ps(&L.phase[i]));
+        __m256 s = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), flickerSin8(_mm256_mul_ps(_mm256_set1_ps(3.5f), tt))),
+            flickerSin8(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(6.5f), tt), _mm256_set1_ps(1.3f))));
+        __m256 v = _mm256_add_ps(_mm256_loadu_ps(&L.base[i]), _mm256_mul_ps(_mm256_loadu_ps(&L.amp[i]), s));
+        __m256 sq = _mm256_and_ps(_mm256_cmp_ps(flickerSin8(_mm256_mul_ps(_mm256_set1_ps(kStrobeRate), tt)), zero, _CMP_GE_OQ), one);
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_loadu_ps(&L.strobe[i]), _mm256_sub_ps(sq, v)));
+        __m256 h = _mm256_mul_ps(flickerSin8(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(47.0f), tt), _mm256_loadu_ps(&L.seed[i]))),
+            _mm256_set1_ps(125.0f));
+        __m256 dip = _mm256_cmp_ps(_mm256_sub_ps(h, _mm256_floor_ps(h)), _mm256_loadu_ps(&L.dipChance[i]), _CMP_LT_OQ);
+        v = _mm256_blendv_ps(v, _mm256_mul_ps(v, _mm256_loadu_ps(&L.dipLevel[i])), dip);
+        _mm256_storeu_ps(&L.out[i], _mm256_min_ps(_mm256_max_ps(v, _mm256_loadu_ps(&L.floor[i])), one));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 tt = _mm_add_ps(_mm_set1_ps(t), _mm_loadu_ps(&L.phase[i]));
+        __m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.5f), flickerSin4(_mm_mul_ps(_mm_set1_ps(3.5f), tt))),
+            flickerSin4(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(6.5f), tt), _mm_set1_ps(1.3f))));
+        __m128 v = _mm_add_ps(_mm_loadu_ps(&L.base[i]), _mm_mul_ps(_mm_loadu_ps(&L.amp[i]), s));
+        __m128 sq = _mm_and_ps(_mm_cmpge_ps(flickerSin4(_mm_mul_ps(_mm_set1_ps(kStrobeRate), tt)), zero), one);
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(&L.strobe[i]), _mm_sub_ps(sq, v)));
+        __m128 h = _mm_mul_ps(flickerSin4(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(47.0f), tt), _mm_loadu_ps(&L.seed[i]))),
+            _mm_set1_ps(125.0f));
+        __m128 dip = _mm_cmplt_ps(_mm_sub_ps(h, flickerFloor4(h)), _mm_loadu_ps(&L.dipChance[i]));
+        v = _mm_or_ps(_mm_and_ps(dip, _mm_mul_ps(v, _mm_loadu_ps(&L.dipLevel[i]))), _mm_andnot_ps(dip, v));
+        _mm_storeu_ps(&L.out[i], _mm_min_ps(_mm_max_ps(v, _mm_loadu_ps(&L.floor[i])), one));
+    }
+#endif
+    flickerScalar(L, t, i, n);
+}
+
+// the bulb plus one lamp per stress-building room, in drawStressScene's order
+void buildSceneLights(int rooms) {
+    g_lightAnim.clear();
+    g_lightAnim.add(FLICKER_STEADY, 0.0f, 0.0f);
+    for (int i = 1; i < rooms; ++i) {
+        uint32_t h = (uint32_t)i * 2654435761u;
+        int style = (h >> 24) % 10 < 7 ? FLICKER_STEADY : (h >> 24) % 10 < 9 ? FLICKER_DYING : FLICKER_STROBE;
+        g_lightAnim.add(style, (float)((h >> 8) & 0xffff) / 65536.0f * 100.0f, (float)(h & 0xff) * 0.37f);
+    }
+}
+
+void updateLightAnimation(float t) {
+    flickerEvaluate(g_lightAnim, t);
+    if (g_lightAnim.count()) g_flicker = g_lightAnim.out[0];
+}
 
-    float sway = animate_on ? 10.0f * sinf(timeSec * 1.4f) : 0.0f;
+int g_bulbLod = 0, g_shadeLod = 0;
+float g_bulbPos[3] = { 0.0f, ROOM_H - 0.33f, 0.0f };    // world position, updated while drawing
+
+// red spotlight on the -Z wall (also read by the volumetric fog)
+const float kSpotPos[3] = { 0.0f, 1.6f, -ROOM_D * 0.5f + 0.2f };
+const float kSpotDir[3] = { 0.0f, -0.1f, 1.0f };
+const float kSpotDiffuse[3] = { 0.55f, 0.05f, 0.05f };
+const float kSpotCutoffDeg = 20.0f, kSpotExponent = 32.0f;
+
+const float kLampAnchorY = ROOM_H - 0.05f, kLampCordLen = 0.28f;
+float lampSwayDeg() { return animate_on ? 10.0f * sinf(timeSec * 1.4f) : 0.0f; }
+void lampBulbPos(float* out3) { memcpy(out3, xformWorld(XF_BULB) + 12, 3 * sizeof(float)); }
+int gpuDrivenActive();
+
+void drawBulbLampAndLight() {
+    DRAW_SCOPE();
+    int drawGeometry = g_objects[OBJ_LAMP].visible && !gpuDrivenActive();
 
     // cord
-    glColor3f(0.2f, 0.2f, 0.2f);
-    glPushMatrix();
-    glTranslatef(0.0f, anchorY, 0.0f);
-    glRotatef(sway, 0.0f, 0.0f, 1.0f);
-    glTranslatef(0.0f, -cordLen * 0.5f, 0.0f);
-    drawBox(0.02f, cordLen, 0.02f);
-    glPopMatrix();
+    if (drawGeometry) {
+        glColor3f(0.2f, 0.2f, 0.2f);
+        glPushMatrix(); glMultMatrixf(xformWorld(XF_CORD)); drawMesh(g_cubeMesh); glPopMatrix();
+    }
 
-    // bulb + light0 position
+    // light0 at the bulb
     GLfloat emit[4] = { 1.0f * g_flicker, 0.96f * g_flicker, 0.85f * g_flicker, 1.0f };
     GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
-    glPushMatrix();
-    glTranslatef(0.0f, anchorY, 0.0f);
-    glRotatef(sway, 0.0f, 0.0f, 1.0f);
-    glTranslatef(0.0f, -cordLen, 0.0f);
-
     GLfloat Lpos[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    glPushMatrix();
+    glMultMatrixf(xformWorld(XF_BULB));
     glLightfv(GL_LIGHT0, GL_POSITION, Lpos);
+    glPopMatrix();
+    lampBulbPos(g_bulbPos);
+    if (!drawGeometry) return;
+
+    // LOD from the bulb's world position (finest sphere level matches the old 24x24)
+    float ppu = pixelsPerUnit(g_bulbPos[0], g_bulbPos[1], g_bulbPos[2]);
+    g_bulbLod = selectLod(g_sphereMesh, 2, SPHERE_LODS, 0.08f, ppu);
+    g_shadeLod = selectLod(g_torusMesh, 0, TORUS_LODS, 1.0f, ppu);
 
     glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emit);
     glColor3f(1.0f, 1.0f, 0.85f);
-    glutSolidSphere(0.08f, 24, 24);
+    glPushMatrix(); glMultMatrixf(xformWorld(XF_BULB_MESH)); drawMesh(g_sphereMesh[g_bulbLod]); glPopMatrix();
     glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, zero);
 
     glColor3f(0.85f, 0.82f, 0.78f);
-    glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-    glutSolidTorus(0.025f, 0.16f, 24, 48);
-    glPopMatrix();
+    glPushMatrix(); glMultMatrixf(xformWorld(XF_SHADE)); drawMesh(g_torusMesh[g_shadeLod]); glPopMatrix();
 }
 
 void setupHorrorLights() {
@@ -490,17 +1742,17 @@ void setupHorrorLights() {
 
     // light1: narrow red spotlight from -Z wall
     glEnable(GL_LIGHT1);
-    GLfloat L1_pos[4] = { 0.0f, 1.6f, -ROOM_D * 0.5f + 0.2f, 1.0f };
-    GLfloat L1_dir[3] = { 0.0f, -0.1f, 1.0f };
-    GLfloat L1_dif[4] = { 0.55f, 0.05f, 0.05f, 1.0f };
+    GLfloat L1_pos[4] = { kSpotPos[0], kSpotPos[1], kSpotPos[2], 1.0f };
+    GLfloat L1_dir[3] = { kSpotDir[0], kSpotDir[1], kSpotDir[2] };
+    GLfloat L1_dif[4] = { kSpotDiffuse[0], kSpotDiffuse[1], kSpotDiffuse[2], 1.0f };
     GLfloat L1_spe[4] = { 0.40f, 0.10f, 0.10f, 1.0f };
     GLfloat L1_amb[4] = { 0.02f, 0.00f, 0.00f, 1.0f };
     glLightfv(GL_LIGHT1, GL_POSITION, L1_pos);
     glLightfv(GL_LIGHT1, GL_DIFFUSE, L1_dif);
     glLightfv(GL_LIGHT1, GL_SPECULAR, L1_spe);
     glLightfv(GL_LIGHT1, GL_AMBIENT, L1_amb);
-    glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 20.0f);
-    glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, 32.0f);
+    glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, kSpotCutoffDeg);
+    glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, kSpotExponent);
     glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, L1_dir);
     glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 1.0f);
     glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.04f);
@@ -540,108 +1792,3707 @@ void applyProjection() {
     glMatrixMode(GL_MODELVIEW);
 }
 
-// ---------------- Input (smoothed with key states) ----------------
-static void updateBoostFromModifiers() {
-    int mod = glutGetModifiers();
-    boostActive = (mod & GLUT_ACTIVE_SHIFT) ? 1 : 0;
+// CPU copies of the GL camera matrices (same math as gluLookAt/gluPerspective/glOrtho)
+float g_viewMat[16], g_projMat[16], g_viewProj[16];
+void computeCameraMatrices() {
+    float aspect = (win_height == 0) ? 1.0f : (float)win_width / (float)win_height;
+    mat4LookAt(g_viewMat, eyeX, eyeY, eyeZ, fwdX, fwdY, fwdZ, upX, upY, upZ);
+    if (use_perspective) mat4Perspective(g_projMat, fovy, aspect, z_near, z_far);
+    else mat4Ortho(g_projMat, -ortho_scale * aspect, ortho_scale * aspect, -ortho_scale, ortho_scale, z_near, z_far);
+    mat4Mul(g_viewProj, g_projMat, g_viewMat);
 }
-
-void keyboardDown(unsigned char key, int x, int y) {
-    gKeyDown[(unsigned char)key] = 1;
-    updateBoostFromModifiers();
-
-    // one-shot actions
-    switch (key) {
-    case 'p': use_perspective = !use_perspective; applyProjection(); break;
-    case 'z': if (use_perspective) { fovy = clampf(fovy - 2.0f, 20.0f, 90.0f); }
-            else { ortho_scale = clampf(ortho_scale * 0.9f, 1.0f, 10.0f); } applyProjection(); break;
-    case 'x': if (use_perspective) { fovy = clampf(fovy + 2.0f, 20.0f, 90.0f); }
-            else { ortho_scale = clampf(ortho_scale / 0.9f, 1.0f, 10.0f); } applyProjection(); break;
-    case 'm': animate_on = !animate_on; break;
-    case 't': showAxes = !showAxes; break;
-    case 'r': eyeX = 3.0f; eyeY = 1.2f; eyeZ = 3.5f; yawDeg = -135.0f; pitchDeg = -8.0f;
-        fovy = 60.0f; ortho_scale = 3.5f; use_perspective = 1; velX = velY = velZ = 0; applyProjection(); break;
-    case 27:  exit(0); // ESC
+// frustum planes (a, b, c, d) with inward normals from the view-projection matrix
+void frustumPlanes(const float* m, float planes[6][4]) {
+    for (int p = 0; p < 6; ++p) {
+        int row = p / 2;
+        float sgn = (p & 1) ? -1.0f : 1.0f;
+        for (int c = 0; c < 4; ++c) planes[p][c] = m[c * 4 + 3] + sgn * m[c * 4 + row];
+        float l = len3(planes[p][0], planes[p][1], planes[p][2]);
+        for (int c = 0; c < 4; ++c) planes[p][c] /= l;
     }
-    glutPostRedisplay();
 }
-void keyboardUp(unsigned char key, int x, int y) {
-    gKeyDown[(unsigned char)key] = 0;
-    updateBoostFromModifiers();
+
+// ---------------- Scene layout ----------------
+// rotate a chair-local point about Y like glRotatef(rotY, 0, 1, 0) and place it
+static void chairToWorld(const ChairPlacement& c, float lx, float lz, float* wx, float* wz) {
+    float s = sinf(c.rotY * DEG2RAD), co = cosf(c.rotY * DEG2RAD);
+    *wx = c.x + lx * co + lz * s;
+    *wz = c.z - lx * s + lz * co;
 }
-void onSpecialDown(int key, int x, int y) {
-    gSpecialKeyDown[key] = 1;
-    updateBoostFromModifiers();
+// world AABB of a chair-local box
+static void chairBoxToWorld(const ChairPlacement& c, const float* lmin, const float* lmax, float* wmin, float* wmax) {
+    wmin[0] = wmin[2] = 1e9f; wmax[0] = wmax[2] = -1e9f;
+    for (int i = 0; i < 4; ++i) {
+        float wx, wz;
+        chairToWorld(c, (i & 1) ? lmax[0] : lmin[0], (i & 2) ? lmax[2] : lmin[2], &wx, &wz);
+        wmin[0] = fminf(wmin[0], wx); wmax[0] = fmaxf(wmax[0], wx);
+        wmin[2] = fminf(wmin[2], wz); wmax[2] = fmaxf(wmax[2], wz);
+    }
+    wmin[1] = lmin[1]; wmax[1] = lmax[1];
 }
-void onSpecialUp(int key, int x, int y) {
-    gSpecialKeyDown[key] = 0;
-    updateBoostFromModifiers();
+static void setBounds(SceneObject& o, float x0, float y0, float z0, float x1, float y1, float z1) {
+    o.bmin[0] = x0; o.bmin[1] = y0; o.bmin[2] = z0;
+    o.bmax[0] = x1; o.bmax[1] = y1; o.bmax[2] = z1;
+    o.visible = 1;
 }
 
-// ---------------- Display & idle ----------------
-void placeChairsAroundTable() {
+void buildSceneObjects() {
     const float tHalfW = 1.20f * 0.5f; // 0.60
     const float tHalfD = 0.80f * 0.5f; // 0.40
     const float seatHalf = 0.45f * 0.5f;
     const float gap = 0.25f;
+    const ChairPlacement chairs[4] = {
+        { 0.0f, -(tHalfD + gap + seatHalf), 0.0f },
+        { 0.0f, (tHalfD + gap + seatHalf), 180.0f },
+        { -(tHalfW + gap + seatHalf), 0.0f, 90.0f },
+        { (tHalfW + gap + seatHalf), 0.0f, -90.0f },
+    };
+    setBounds(g_objects[OBJ_TABLE], -0.60f, 0.0f, -0.40f, 0.60f, 0.79f, 0.40f);
+    const float chairMin[3] = { -0.225f, 0.0f, -0.225f }, chairMax[3] = { 0.225f, 0.90f, 0.225f };
+    for (int i = 0; i < 4; ++i) {
+        g_chairs[i] = chairs[i];
+        chairBoxToWorld(chairs[i], chairMin, chairMax, g_objects[OBJ_CHAIR0 + i].bmin, g_objects[OBJ_CHAIR0 + i].bmax);
+        g_objects[OBJ_CHAIR0 + i].visible = 1;
+    }
+    setBounds(g_objects[OBJ_EARTH], 0.17f, 0.72f, -0.13f, 0.53f, 1.08f, 0.23f);
+    // lamp: anchor, cord and bulb/shade swept over the +-10 degree sway
+    setBounds(g_objects[OBJ_LAMP], -0.25f, ROOM_H - 0.40f, -0.19f, 0.25f, ROOM_H, 0.19f);
+}
 
-    glPushMatrix(); glTranslatef(0.0f, 0.0f, -(tHalfD + gap + seatHalf));                    drawChair(); glPopMatrix();
-    glPushMatrix(); glTranslatef(0.0f, 0.0f, (tHalfD + gap + seatHalf)); glRotatef(180, 0, 1, 0); drawChair(); glPopMatrix();
-    glPushMatrix(); glTranslatef(-(tHalfW + gap + seatHalf), 0.0f, 0.0f); glRotatef(90, 0, 1, 0); drawChair(); glPopMatrix();
-    glPushMatrix(); glTranslatef((tHalfW + gap + seatHalf), 0.0f, 0.0f); glRotatef(-90, 0, 1, 0); drawChair(); glPopMatrix();
+// edits only the nodes whose animation value changed, then updates
+void animateSceneTransforms() {
+    static float lastSway = NAN, lastEarth = NAN;
+    float sway = lampSwayDeg();
+    if (sway != lastSway) {
+        float* m = xformEdit(XF_LAMP);
+        mat4Identity(m);
+        mat4Translate(m, 0.0f, kLampAnchorY, 0.0f);
+        mat4Rotate(m, sway, 0.0f, 0.0f, 1.0f);
+        lastSway = sway;
+    }
+    if (earthAngle != lastEarth) {
+        float* m = xformEdit(XF_EARTH);
+        mat4Identity(m);
+        mat4Translate(m, 0.35f, 0.90f, 0.05f);     // on the table
+        mat4Rotate(m, earthAngle, 0.0f, 1.0f, 0.0f);
+        lastEarth = earthAngle;
+    }
+    xformUpdate();
 }
 
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// table -> chairs, Earth; lamp anchor (sway) -> cord, bulb -> bulb mesh, shade
+void buildSceneTransforms() {
+    xformCreate(-1);                                            // XF_TABLE (room origin)
+    for (int i = 0; i < 4; ++i) {
+        float* m = xformEdit(xformCreate(XF_TABLE));            // XF_CHAIR0 + i
+        mat4Translate(m, g_chairs[i].x, 0.0f, g_chairs[i].z);
+        mat4Rotate(m, g_chairs[i].rotY, 0.0f, 1.0f, 0.0f);
+    }
+    xformCreate(XF_TABLE);                                      // XF_EARTH, animated
+    xformCreate(-1);                                            // XF_LAMP, animated
+    float* m = xformEdit(xformCreate(XF_LAMP));                 // XF_CORD
+    mat4Translate(m, 0.0f, -kLampCordLen * 0.5f, 0.0f);
+    mat4Scale(m, 0.02f, kLampCordLen, 0.02f);
+    mat4Translate(xformEdit(xformCreate(XF_LAMP)), 0.0f, -kLampCordLen, 0.0f);  // XF_BULB (light 0)
+    mat4Scale(xformEdit(xformCreate(XF_BULB)), 0.08f, 0.08f, 0.08f);            // XF_BULB_MESH
+    mat4Rotate(xformEdit(xformCreate(XF_BULB)), 90.0f, 1.0f, 0.0f, 0.0f);       // XF_SHADE
+    animateSceneTransforms();
+}
 
-    // camera
-    updateCameraBasis();
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    gluLookAt(eyeX, eyeY, eyeZ, eyeX + fwdX, eyeY + fwdY, eyeZ + fwdZ, upX, upY, upZ);
+// ---------------- Occlusion culling (CPU) ----------------
+// A few large occluders (walls, table top, chair backs) are rasterized into a
+// small depth buffer as jobs, then every object's screen-space
+// bounds are tested against it before the object is submitted.
+#define OCC_W 256
+#define OCC_H 128
+#define OCC_TILE_W 64
+#define OCC_TILE_H 32
+#define OCC_TILES_X (OCC_W / OCC_TILE_W)
+#define OCC_TILES_Y (OCC_H / OCC_TILE_H)
+#define OCC_MAX_QUADS 64
+#define OCC_MAX_TRIS (OCC_MAX_QUADS * 3)
 
-    // lights (params updated per frame)
-    setupHorrorLights();
+struct OccTri {
+    float a[3], b[3], c[3];  // edge functions E(x,y) = a*x + b*y + c, inside when all >= 0
+    float za, zb, zc;        // depth plane z(x,y) = za*x + zb*y + zc
+    int minX, minY, maxX, maxY;
+};
+float g_occQuads[OCC_MAX_QUADS][4][3];  // world-space occluder quads
+int g_occQuadCount = 0;
+static OccTri g_occTris[OCC_MAX_TRIS];
+static int g_occTriCount = 0;
+alignas(32) static float g_occDepth[OCC_W * OCC_H];  // NDC depth in [0,1], 1 = far
 
-    // scene
-    drawRoom();
-    axes();
+static void addOccluderQuad(const float* p0, const float* p1, const float* p2, const float* p3) {
+    if (g_occQuadCount >= OCC_MAX_QUADS) return;
+    memcpy(g_occQuads[g_occQuadCount][0], p0, 3 * sizeof(float));
+    memcpy(g_occQuads[g_occQuadCount][1], p1, 3 * sizeof(float));
+    memcpy(g_occQuads[g_occQuadCount][2], p2, 3 * sizeof(float));
+    memcpy(g_occQuads[g_occQuadCount][3], p3, 3 * sizeof(float));
+    ++g_occQuadCount;
+}
+static void addOccluderBox(const float* bmin, const float* bmax) {
+    float c[8][3];
+    for (int i = 0; i < 8; ++i) {
+        c[i][0] = (i & 1) ? bmax[0] : bmin[0];
+        c[i][1] = (i & 2) ? bmax[1] : bmin[1];
+        c[i][2] = (i & 4) ? bmax[2] : bmin[2];
+    }
+    addOccluderQuad(c[0], c[1], c[3], c[2]); addOccluderQuad(c[4], c[5], c[7], c[6]); // -Z, +Z
+    addOccluderQuad(c[0], c[2], c[6], c[4]); addOccluderQuad(c[1], c[3], c[7], c[5]); // -X, +X
+    addOccluderQuad(c[0], c[1], c[5], c[4]); addOccluderQuad(c[2], c[3], c[7], c[6]); // -Y, +Y
+}
 
-    drawTable();
-    placeChairsAroundTable();
+void buildOccluders() {
+    const float x0 = -ROOM_W * 0.5f, x1 = ROOM_W * 0.5f;
+    const float z0 = -ROOM_D * 0.5f, z1 = ROOM_D * 0.5f;
+    const float y0 = 0.0f, y1 = ROOM_H;
+    g_occQuadCount = 0;
 
-    glPushMatrix();
-    glTranslatef(0.35f, 0.90f, 0.05f); // Earth on table
-    drawTexturedEarth(0.18f);
-    glPopMatrix();
+    // walls
+    const float w[4][4][3] = {
+        { { x1, y0, z0 }, { x1, y0, z1 }, { x1, y1, z1 }, { x1, y1, z0 } },
+        { { x0, y0, z1 }, { x0, y0, z0 }, { x0, y1, z0 }, { x0, y1, z1 } },
+        { { x0, y0, z1 }, { x1, y0, z1 }, { x1, y1, z1 }, { x0, y1, z1 } },
+        { { x1, y0, z0 }, { x0, y0, z0 }, { x0, y1, z0 }, { x1, y1, z0 } },
+    };
+    for (int i = 0; i < 4; ++i) addOccluderQuad(w[i][0], w[i][1], w[i][2], w[i][3]);
 
-    drawBulbLampAndLight();
+    // table top
+    const float topMin[3] = { -0.60f, 0.71f, -0.40f }, topMax[3] = { 0.60f, 0.79f, 0.40f };
+    addOccluderBox(topMin, topMax);
 
-    displayLabel();
-    glutSwapBuffers();
+    // chair backrests (chair-local box, see drawChair)
+    const float backMin[3] = { -0.225f, 0.45f, -0.225f }, backMax[3] = { 0.225f, 0.90f, -0.165f };
+    for (int i = 0; i < 4; ++i) {
+        float wmin[3], wmax[3];
+        chairBoxToWorld(g_chairs[i], backMin, backMax, wmin, wmax);
+        addOccluderBox(wmin, wmax);
+    }
 }
 
-void idle() {
-    int t = glutGet(GLUT_ELAPSED_TIME);
-    if (lastTimeMS == 0) lastTimeMS = t;
-    int dtMS = t - lastTimeMS;
-    lastTimeMS = t;
-    float dt = dtMS * 0.001f;
+// clip -> occlusion buffer pixels; returns 0 if the point is behind the near plane
+static int occProject(const float* clip, float* sx, float* sy, float* sz) {
+    if (clip[3] <= 1e-5f) return 0;
+    float iw = 1.0f / clip[3];
+    *sx = (clip[0] * iw * 0.5f + 0.5f) * OCC_W;
+    *sy = (clip[1] * iw * 0.5f + 0.5f) * OCC_H;
+    *sz = clip[2] * iw * 0.5f + 0.5f;
+    return 1;
+}
 
-    if (animate_on) {
-        timeSec += dt;
-        earthAngle += 10.0f * dt;
-        if (earthAngle >= 360.0f) earthAngle -= 360.0f;
+static void occSetupTri(const float* x, const float* y, const float* z) {
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (fabsf(area) < 1e-6f) return;
+    OccTri& t = g_occTris[g_occTriCount];
+    float s = area > 0 ? 1.0f : -1.0f;
+    for (int i = 0; i < 3; ++i) {
+        int j = (i + 1) % 3;
+        t.a[i] = s * (y[i] - y[j]);
+        t.b[i] = s * (x[j] - x[i]);
+        t.c[i] = s * (x[i] * y[j] - x[j] * y[i]);
     }
+    // barycentric weight of vertex k is the edge opposite to it divided by the area
+    float ia = 1.0f / fabsf(area);
+    t.za = (t.a[1] * z[0] + t.a[2] * z[1] + t.a[0] * z[2]) * ia;
+    t.zb = (t.b[1] * z[0] + t.b[2] * z[1] + t.b[0] * z[2]) * ia;
+    t.zc = (t.c[1] * z[0] + t.c[2] * z[1] + t.c[0] * z[2]) * ia;
+    float mnx = fminf(x[0], fminf(x[1], x[2])), mxx = fmaxf(x[0], fmaxf(x[1], x[2]));
+    float mny = fminf(y[0], fminf(y[1], y[2])), mxy = fmaxf(y[0], fmaxf(y[1], y[2]));
+    t.minX = (int)clampf(floorf(mnx), 0, OCC_W - 1); t.maxX = (int)clampf(ceilf(mxx), 0, OCC_W - 1);
+    t.minY = (int)clampf(floorf(mny), 0, OCC_H - 1); t.maxY = (int)clampf(ceilf(mxy), 0, OCC_H - 1);
+    if (mxx < 0 || mxy < 0 || mnx >= OCC_W || mny >= OCC_H) return;
+    ++g_occTriCount;
+}
 
-    // continuous look
-    float yawRate = 0.0f, pitchRate = 0.0f;
-    if (gSpecialKeyDown[GLUT_KEY_LEFT]) yawRate -= lookSpeed;
+static void occRasterTile(int tile, void*) {
+    PROFILE_FUNCTION();
+    const int tx0 = (tile % OCC_TILES_X) * OCC_TILE_W, ty0 = (tile / OCC_TILES_X) * OCC_TILE_H;
+    const int tx1 = tx0 + OCC_TILE_W - 1, ty1 = ty0 + OCC_TILE_H - 1;
+    for (int y = ty0; y <= ty1; ++y)
+        for (int x = tx0; x <= tx1; ++x) g_occDepth[y * OCC_W + x] = 1.0f;
+
+    for (int i = 0; i < g_occTriCount; ++i) {
+        const OccTri& t = g_occTris[i];
+        int x0 = t.minX > tx0 ? t.minX : tx0, x1 = t.maxX < tx1 ? t.maxX : tx1;
+        int y0 = t.minY > ty0 ? t.minY : ty0, y1 = t.maxY < ty1 ? t.maxY : ty1;
+        if (x0 > x1 || y0 > y1) continue;
+        x0 &= ~7; // 8-wide spans stay inside the tile since tiles are 8-aligned
+        for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            float* row = g_occDepth + y * OCC_W;
+            float r0 = t.b[0] * py + t.c[0], r1 = t.b[1] * py + t.c[1], r2 = t.b[2] * py + t.c[2];
+            float rz = t.zb * py + t.zc;
+#if defined(__AVX2__)
+            const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            const __m256 zero = _mm256_setzero_ps();
+            for (int x = x0; x <= x1; x += 8) {
+                __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+                __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[0]), px), _mm256_set1_ps(r0));
+                __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[1]), px), _mm256_set1_ps(r1));
+                __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.a[2]), px), _mm256_set1_ps(r2));
+                __m256 in = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                    _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+                if (_mm256_movemask_ps(in) == 0) continue;
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.za), px), _mm256_set1_ps(rz));
+                __m256 d = _mm256_load_ps(row + x);
+                _mm256_store_ps(row + x, _mm256_blendv_ps(d, _mm256_min_ps(d, z), in));
+            }
+#else
+            for (int x = x0; x <= x1; ++x) {
+                float px = x + 0.5f;
+                if (t.a[0] * px + r0 < 0 || t.a[1] * px + r1 < 0 || t.a[2] * px + r2 < 0) continue;
+                float z = t.za * px + rz;
+                if (z < row[x]) row[x] = z;
+            }
+#endif
+        }
+    }
+}
+
+// 0 = visible, 1 = occluded, 2 = outside the view
+static int occTestBounds(const float* bmin, const float* bmax) {
+    float mnx = 1e9f, mny = 1e9f, mxx = -1e9f, mxy = -1e9f, mnz = 1e9f;
+    int outcodeAnd = 63;
+    for (int i = 0; i < 8; ++i) {
+        float c[4];
+        mat4TransformPoint(g_viewProj, (i & 1) ? bmax[0] : bmin[0], (i & 2) ? bmax[1] : bmin[1], (i & 4) ? bmax[2] : bmin[2], c);
+        int code = (c[0] < -c[3]) | ((c[0] > c[3]) << 1) | ((c[1] < -c[3]) << 2) | ((c[1] > c[3]) << 3) |
+            ((c[2] < -c[3]) << 4) | ((c[2] > c[3]) << 5);
+        outcodeAnd &= code;
+        float sx, sy, sz;
+        if (!occProject(c, &sx, &sy, &sz)) { mnz = -1.0f; continue; }
+        mnx = fminf(mnx, sx); mxx = fmaxf(mxx, sx);
+        mny = fminf(mny, sy); mxy = fmaxf(mxy, sy);
+        mnz = fminf(mnz, sz);
+    }
+    if (outcodeAnd) return 2;
+    if (mnz <= 0.0f) return 0; // crosses the near plane
+    int x0 = (int)clampf(floorf(mnx), 0, OCC_W - 1), x1 = (int)clampf(floorf(mxx), 0, OCC_W - 1);
+    int y0 = (int)clampf(floorf(mny), 0, OCC_H - 1), y1 = (int)clampf(floorf(mxy), 0, OCC_H - 1);
+    for (int y = y0; y <= y1; ++y) {
+        const float* row = g_occDepth + y * OCC_W;
+        for (int x = x0; x <= x1; ++x)
+            if (row[x] >= mnz) return 0;
+    }
+    return 1;
+}
+
+void cullScene() {
+    PROFILE_FUNCTION();
+    double t0 = nowMs();
+    OcclusionStats st = {};
+    if (!occlusion_on) {
+        for (int i = 0; i < OBJ_COUNT; ++i) g_objects[i].visible = 1;
+        st.tested = st.drawn = OBJ_COUNT;
+        st.costMs = g_occStats.costMs;
+        g_occStats = st;
+        return;
+    }
+
+    // transform, clip against the near plane, fan-triangulate
+    g_occTriCount = 0;
+    for (int q = 0; q < g_occQuadCount; ++q) {
+        float in[4][4], out[8][4];
+        for (int v = 0; v < 4; ++v)
+            mat4TransformPoint(g_viewProj, g_occQuads[q][v][0], g_occQuads[q][v][1], g_occQuads[q][v][2], in[v]);
+        int n = 0;
+        for (int v = 0; v < 4; ++v) {
+            const float* a = in[v]; const float* b = in[(v + 1) % 4];
+            float da = a[2] + a[3], db = b[2] + b[3];  // distance to z = -w
+            if (da >= 0) memcpy(out[n++], a, sizeof(in[0]));
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                for (int k = 0; k < 4; ++k) out[n][k] = a[k] + (b[k] - a[k]) * t;
+                ++n;
+            }
+        }
+        if (n < 3) continue;
+        float x[8], y[8], z[8];
+        int ok = 1;
+        for (int v = 0; v < n && ok; ++v) {
+            ok = occProject(out[v], &x[v], &y[v], &z[v]);
+            z[v] = clampf(z[v], 0.0f, 1.0f);
+        }
+        for (int v = 1; ok && v + 1 < n && g_occTriCount < OCC_MAX_TRIS; ++v) {
+            float tx[3] = { x[0], x[v], x[v + 1] }, ty[3] = { y[0], y[v], y[v + 1] }, tz[3] = { z[0], z[v], z[v + 1] };
+            occSetupTri(tx, ty, tz);
+        }
+    }
+    jobParallelFor(OCC_TILES_X * OCC_TILES_Y, occRasterTile, nullptr, 1);
+
+    for (int i = 0; i < OBJ_COUNT; ++i) {
+        int r = occTestBounds(g_objects[i].bmin, g_objects[i].bmax);
+        g_objects[i].visible = (r == 0);
+        st.tested++;
+        if (r == 1) st.occluded++;
+        else if (r == 2) st.outside++;
+        else st.drawn++;
+    }
+    st.occluderTris = g_occTriCount;
+    float ms = (float)(nowMs() - t0);
+    st.costMs = g_occStats.costMs + (ms - g_occStats.costMs) * 0.1f;
+    st.lastMs = ms;
+    g_occStats = st;
+}
+
+// ---------------- Render targets ----------------
+// Offscreen colour + depth textures behind a framebuffer object.
+struct RenderTarget { GLuint fbo, color, depth; int w, h; };
+
+void destroyRenderTarget(RenderTarget& rt) {
+    if (rt.fbo) glDeleteFramebuffers(1, &rt.fbo);
+    if (rt.color) glDeleteTextures(1, &rt.color);
+    if (rt.depth) glDeleteTextures(1, &rt.depth);
+    memset(&rt, 0, sizeof(rt));
+}
+
+int createRenderTarget(RenderTarget& rt, int w, int h, int withDepth) {
+    destroyRenderTarget(rt);
+    rt.w = w; rt.h = h;
+    glGenTextures(1, &rt.color);
+    glBindTexture(GL_TEXTURE_2D, rt.color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (withDepth) {
+        glGenTextures(1, &rt.depth);
+        glBindTexture(GL_TEXTURE_2D, rt.depth);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &rt.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rt.color, 0);
+    if (withDepth) glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, rt.depth, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("FBO: %dx%d incomplete (0x%x)\n", w, h, status);
+        destroyRenderTarget(rt);
+        return 0;
+    }
+    return 1;
+}
+
+// ---------------- Shaders & GPU timers ----------------
+static GLuint compileShader(GLenum type, const char* src, const char* name) {
+    GLuint sh = glCreateShader(type);
+    glShaderSource(sh, 1, &src, NULL);
+    glCompileShader(sh);
+    GLint ok = 0;
+    glGetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[2048];
+        glGetShaderInfoLog(sh, sizeof(log), NULL, log);
+        printf("Shader '%s': compile failed\n%s\n", name, log);
+        glDeleteShader(sh);
+        return 0;
+    }
+    return sh;
+}
+
+static GLuint linkProgram(GLuint* shaders, int count, const char* name) {
+    GLuint prog = glCreateProgram();
+    for (int i = 0; i < count; ++i) glAttachShader(prog, shaders[i]);
+    glLinkProgram(prog);
+    for (int i = 0; i < count; ++i) glDeleteShader(shaders[i]);
+    GLint ok = 0;
+    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[2048];
+        glGetProgramInfoLog(prog, sizeof(log), NULL, log);
+        printf("Program '%s': link failed\n%s\n", name, log);
+        glDeleteProgram(prog);
+        return 0;
+    }
+    return prog;
+}
+
+GLuint buildProgram(const char* vs, const char* fs, const char* name) {
+    GLuint sh[2] = { compileShader(GL_VERTEX_SHADER, vs, name), compileShader(GL_FRAGMENT_SHADER, fs, name) };
+    if (!sh[0] || !sh[1]) {
+        if (sh[0]) glDeleteShader(sh[0]);
+        if (sh[1]) glDeleteShader(sh[1]);
+        return 0;
+    }
+    return linkProgram(sh, 2, name);
+}
+
+static GLuint buildComputeProgram(const char* cs, const char* name) {
+    GLuint sh = compileShader(GL_COMPUTE_SHADER, cs, name);
+    return sh ? linkProgram(&sh, 1, name) : 0;
+}
+
+// full-screen passes: gl_Vertex is already in NDC, uv = gl_Vertex.xy * 0.5 + 0.5
+const char* kFullscreenVS =
+    "#version 120\n"
+    "varying vec2 uv;\n"
+    "void main() { uv = gl_Vertex.xy * 0.5 + 0.5; gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0); }\n";
+
+void drawFullscreenQuad() {
+    glBegin(GL_QUADS);
+    glVertex2f(-1, -1); glVertex2f(1, -1); glVertex2f(1, 1); glVertex2f(-1, 1);
+    glEnd();
+}
+
+// GPU time between two timestamp queries, read back GPU_TIMER_LAG frames
+// later so the CPU never waits on a query result. Timers may nest.
+#define GPU_TIMER_LAG 4
+struct GpuTimer { GLuint q[GPU_TIMER_LAG][2]; int pending[GPU_TIMER_LAG]; float ms; };
+int g_gpuTimersSupported = 0;
+unsigned g_frameIndex = 0;
+
+void gpuTimerBegin(GpuTimer& t) {
+    if (!g_gpuTimersSupported) return;
+    int i = g_frameIndex % GPU_TIMER_LAG;
+    if (!t.q[0][0]) glGenQueries(2 * GPU_TIMER_LAG, &t.q[0][0]);
+    if (t.pending[i]) {
+        GLint ready = 0;
+        glGetQueryObjectiv(t.q[i][1], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (ready) {
+            GLuint64 a = 0, b = 0;
+            glGetQueryObjectui64v(t.q[i][0], GL_QUERY_RESULT, &a);
+            glGetQueryObjectui64v(t.q[i][1], GL_QUERY_RESULT, &b);
+            float ms = (float)((double)(b - a) * 1e-6);
+            t.ms += (ms - t.ms) * 0.2f;
+        }
+    }
+    glQueryCounter(t.q[i][0], GL_TIMESTAMP);
+}
+
+void gpuTimerEnd(GpuTimer& t) {
+    if (!g_gpuTimersSupported) return;
+    int i = g_frameIndex % GPU_TIMER_LAG;
+    glQueryCounter(t.q[i][1], GL_TIMESTAMP);
+    t.pending[i] = 1;
+}
+
+// ---------------- Streaming uploads (ring buffer) ----------------
+// Per-frame dynamic data goes through one persistently mapped, coherent
+// buffer split into STREAM_FRAMES regions. The frame boundary fences the
+// region just written and waits (normally not at all) for the GPU to finish
+// with the next one; within a frame any subsystem bump-allocates from that
+// region and writes through the returned pointer with plain stores - no GL
+// call until the range is bound. Without GL 4.4 buffer storage the same API
+// stages in client memory and uploads an allocation when it is bound.
+#define STREAM_FRAMES 3
+#define STREAM_REGION_BYTES (256 * 1024)
+struct StreamRing {
+    GLuint buf;
+    unsigned char* mapped;                  // persistent mapping, or NULL
+    std::vector<unsigned char> staging;     // fallback backing store
+    GLsync fence[STREAM_FRAMES];
+    int region;
+    size_t head, used, peak;                // bytes in the current region; last frame; high-water mark
+    GLint uboAlign, ssboAlign;
+    int overflows, waits;
+    float waitMs;
+};
+struct StreamAlloc { void* ptr; GLintptr offset; GLsizeiptr size; };
+StreamRing g_stream;
+
+void streamInit() {
+    StreamRing& s = g_stream;
+    if (!GLEW_VERSION_3_1) { printf("Streaming: unavailable (needs uniform buffers)\n"); return; }
+    GLsizeiptr total = (GLsizeiptr)STREAM_FRAMES * STREAM_REGION_BYTES;
+    glGenBuffers(1, &s.buf);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s.buf);
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, total, NULL, flags);
+        s.mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, total, flags);
+    }
+    if (!s.mapped) {
+        glBufferData(GL_COPY_WRITE_BUFFER, total, NULL, GL_STREAM_DRAW);
+        s.staging.resize(total);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    s.uboAlign = s.ssboAlign = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &s.uboAlign);
+    if (GLEW_VERSION_4_3) glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &s.ssboAlign);
+    printf("Streaming: %d x %d KB ring, %s\n", STREAM_FRAMES, STREAM_REGION_BYTES / 1024,
+        s.mapped ? "persistently mapped" : "staged (no buffer storage)");
+}
+
+// frame boundary: everything the previous frame wrote is behind its fence
+void streamBeginFrame() {
+    PROFILE_FUNCTION();
+    StreamRing& s = g_stream;
+    if (!s.buf) return;
+    s.used = s.head;
+    if (s.mapped) s.fence[s.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.region = (s.region + 1) % STREAM_FRAMES;
+    s.head = 0;
+    if (!s.fence[s.region]) return;
+    // the region is written by the CPU next, so it is only handed out once
+    // the GPU is done with it, however long that takes
+    GLenum r = glClientWaitSync(s.fence[s.region], 0, 0);
+    if (r == GL_TIMEOUT_EXPIRED) {
+        double t0 = nowMs();
+        r = glClientWaitSync(s.fence[s.region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        while (r == GL_TIMEOUT_EXPIRED) r = glClientWaitSync(s.fence[s.region], 0, 1000000000ull);
+        ++s.waits;
+        s.waitMs += (float)(nowMs() - t0);
+    }
+    if (r == GL_WAIT_FAILED) {
+        printf("Streaming: fence wait failed, draining the GPU\n");
+        glFinish();
+    }
+    glDeleteSync(s.fence[s.region]);
+    s.fence[s.region] = 0;
+}
+
+// bump allocation in the current region; ptr is NULL when the region is full
+StreamAlloc streamAlloc(size_t size, size_t align) {
+    StreamRing& s = g_stream;
+    StreamAlloc a = { NULL, 0, 0 };
+    size_t off = (s.head + align - 1) / align * align;
+    if (!s.buf || off + size > STREAM_REGION_BYTES) {
+        if (s.buf && !s.overflows++) printf("Streaming: region overflow (%zu bytes requested)\n", size);
+        return a;
+    }
+    s.head = off + size;
+    if (s.head > s.peak) s.peak = s.head;
+    size_t at = (size_t)s.region * STREAM_REGION_BYTES + off;
+    a.ptr = (s.mapped ? s.mapped : s.staging.data()) + at;
+    a.offset = (GLintptr)at;
+    a.size = (GLsizeiptr)size;
+    return a;
+}
+
+void streamBind(GLenum target, GLuint index, const StreamAlloc& a) {
+    if (!a.ptr) return;
+    if (!g_stream.mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, g_stream.buf);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, a.offset, a.size, a.ptr);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glBindBufferRange(target, index, g_stream.buf, a.offset, a.size);
+}
+
+// per-frame constants shared by the GPU-driven passes and the fog (std140,
+// uniform block binding 0); written once per frame into the ring
+struct FrameConstants {
+    float view[16], proj[16], viewProj[16];
+    float planes[6][4];
+    float eye[4];        // w: seconds
+    float fwd[4];        // w: near plane
+    float right[4];      // w: pixels per world unit at unit depth (orthographic: per unit)
+    float up[4];         // w: 1 when orthographic
+    float bulbPos[4];    // w: flicker
+    float bulbColor[4];  // flicker-scaled diffuse; w: lamp sway (degrees)
+    float params[4];     // x: Earth angle, y: LOD error (px), z: LOD on
+};
+
+#define FRAME_CONSTANTS_GLSL \
+    "layout(std140, binding = 0) uniform FrameConstants {\n" \
+    "    mat4 view, proj, viewProj;\n" \
+    "    vec4 planes[6];\n" \
+    "    vec4 eye, fwd, right, up;\n" \
+    "    vec4 bulbPos, bulbColor;\n" \
+    "    vec4 params;\n" \
+    "};\n"
+
+void frameConstantsUpdate() {
+    StreamAlloc a = streamAlloc(sizeof(FrameConstants), g_stream.uboAlign);
+    FrameConstants* fc = (FrameConstants*)a.ptr;
+    if (!fc) return;
+    memcpy(fc->view, g_viewMat, sizeof(fc->view));
+    memcpy(fc->proj, g_projMat, sizeof(fc->proj));
+    memcpy(fc->viewProj, g_viewProj, sizeof(fc->viewProj));
+    frustumPlanes(g_viewProj, fc->planes);
+    float f = g_flicker;
+    float ppuScale = use_perspective ? win_height / (2.0f * tanf(fovy * 0.5f * DEG2RAD)) : win_height / (2.0f * ortho_scale);
+    fc->eye[0] = eyeX; fc->eye[1] = eyeY; fc->eye[2] = eyeZ; fc->eye[3] = timeSec;
+    fc->fwd[0] = fwdX; fc->fwd[1] = fwdY; fc->fwd[2] = fwdZ; fc->fwd[3] = z_near;
+    fc->right[0] = rgtX; fc->right[1] = rgtY; fc->right[2] = rgtZ; fc->right[3] = ppuScale;
+    fc->up[0] = upX; fc->up[1] = upY; fc->up[2] = upZ; fc->up[3] = use_perspective ? 0.0f : 1.0f;
+    lampBulbPos(fc->bulbPos);
+    fc->bulbPos[3] = f;
+    fc->bulbColor[0] = 1.00f * f; fc->bulbColor[1] = 0.88f * f; fc->bulbColor[2] = 0.60f * f; fc->bulbColor[3] = lampSwayDeg();
+    fc->params[0] = earthAngle; fc->params[1] = g_lodErrorPx; fc->params[2] = (float)lod_on; fc->params[3] = 0.0f;
+    streamBind(GL_UNIFORM_BUFFER, 0, a);
+}
+
+// ---------------- Depth pre-pass & overdraw view (F2-F4) ----------------
+// With the pre-pass on, the opaque scene goes through its draw path twice:
+// depth only (flat programs, colour writes off), then shaded with depth test
+// GL_EQUAL and depth writes off, so each pixel runs the lighting once. The
+// flat programs transform exactly like the shading ones (same vertex shader
+// with an invariant gl_Position, or ftransform() for fixed function), which
+// GL_EQUAL relies on. Front-to-back ordering draws the furniture nearest
+// first and the room shell, which is behind everything, last. The overdraw
+// view shades with an additive constant instead, so brightness counts the
+// fragments that passed the depth test.
+enum { PASS_SHADE, PASS_DEPTH, PASS_OVERDRAW };
+enum { ORDER_DEFAULT, ORDER_FRONT, ORDER_PREPASS, ORDER_BOTH, ORDER_MODES };
+const char* kOrderModeName[ORDER_MODES] = { "default", "front-to-back", "pre-pass", "both" };
+int g_depthPrepass = 0;     // F2
+int g_frontToBack = 0;      // F3
+int g_overdrawView = 0;     // F4
+int g_scenePass = PASS_SHADE;
+int g_prepassDone = 0;      // depth is laid down; culling and recording already ran this frame
+GLuint g_flatProg = 0, g_batchFlatProg = 0, g_gpuFlatProg = 0;
+float g_overdraw[ORDER_MODES];          // shaded samples per pixel measured under each mode (0: not yet)
+float g_overdrawFrameMs[ORDER_MODES];   // GPU frame time under each mode, outside the overdraw view
+unsigned g_overdrawSwitchFrame = 0;
+
+const char* kFlatVS =
+    "#version 130\n"
+    "void main() { gl_Position = ftransform(); }\n";
+
+// each fragment adds one step; channels saturate red -> yellow -> white
+const char* kFlatFS =
+    "#version 130\n"
+    "void main() { gl_FragColor = vec4(0.25, 0.0625, 0.015625, 1.0); }\n";
+
+void depthPrepassInit() {
+    if (GLEW_VERSION_3_0) g_flatProg = buildProgram(kFlatVS, kFlatFS, "flat");
+    if (!g_flatProg) printf("Depth pre-pass / overdraw view: unavailable (needs GL 3.0)\n");
+}
+
+int orderMode() { return (g_depthPrepass && g_flatProg ? ORDER_PREPASS : 0) + (g_frontToBack ? ORDER_FRONT : 0); }
+
+// program for the immediate-mode draws of the current pass
+GLuint passProgram() { return g_scenePass == PASS_SHADE ? 0 : g_flatProg; }
+
+// OBJ_* draw order: as declared, or nearest bounding box first
+void sceneDrawOrder(int* order) {
+    float d[OBJ_COUNT];
+    for (int o = 0; o < OBJ_COUNT; ++o) {
+        const SceneObject& b = g_objects[o];
+        float dx = fmaxf(fmaxf(b.bmin[0] - eyeX, eyeX - b.bmax[0]), 0.0f);
+        float dy = fmaxf(fmaxf(b.bmin[1] - eyeY, eyeY - b.bmax[1]), 0.0f);
+        float dz = fmaxf(fmaxf(b.bmin[2] - eyeZ, eyeZ - b.bmax[2]), 0.0f);
+        d[o] = g_frontToBack ? dx * dx + dy * dy + dz * dz : (float)o;
+        int k = o;
+        for (; k > 0 && d[order[k - 1]] > d[o]; --k) order[k] = order[k - 1];
+        order[k] = o;
+    }
+}
+
+// ---------------- Material array & static batch (K) ----------------
+// All material images are resampled to one size and packed into a
+// GL_TEXTURE_2D_ARRAY; each vertex carries its layer in the third texture
+// coordinate (< 0: untextured). That lets the room shell go out in one draw
+// and the furniture that survives culling in one glMultiDrawElements. The
+// shader reproduces the fixed-function lighting/fog from the built-in GL
+// state (per pixel rather than per vertex). The Earth, lamp and stress
+// content keep the fixed-function path.
+enum { MAT_FLOOR, MAT_WALL, MAT_CEIL, MAT_WOOD, MAT_PAINTING, MAT_EARTH, MAT_LAYERS };
+const char* kMatFile[MAT_LAYERS] = { "textures/floor.jpg", "textures/wall.jpg", "textures/ceiling.jpg",
+    "textures/wood.jpg", "textures/painting.jpg", "textures/earth2.jpg" };
+GLuint g_matArray = 0;
+int g_matSize = 0;
+int g_matLoaded[MAT_LAYERS];
+int g_batch_on = 1;
+int g_batchSupported = 0;
+GLuint g_batchProg = 0;
+Mesh g_batchMesh;
+struct BatchRange { int first, count; };
+BatchRange g_batchShell, g_batchObj[OBJ_COUNT];
+int g_batchDraws = 0;
+
+// 1D resample of n-channel float rows: box filter when shrinking, linear when growing
+static void resampleAxis(const float* src, int sn, float* dst, int dn, int stride, int ch) {
+    float scale = (float)sn / dn;
+    for (int i = 0; i < dn; ++i) {
+        float* d = dst + i * stride * ch;
+        if (scale > 1.0f) {
+            float a = i * scale, b = a + scale;
+            for (int c = 0; c < ch; ++c) d[c] = 0.0f;
+            for (int k = (int)a; k < sn && k < b; ++k) {
+                float w = fminf(b, k + 1.0f) - fmaxf(a, (float)k);
+                for (int c = 0; c < ch; ++c) d[c] += w * src[k * stride * ch + c];
+            }
+            for (int c = 0; c < ch; ++c) d[c] /= scale;
+        }
+        else {
+            float x = clampf((i + 0.5f) * scale - 0.5f, 0.0f, (float)(sn - 1));
+            int k = (int)x, k1 = k + 1 < sn ? k + 1 : k;
+            float t = x - k;
+            for (int c = 0; c < ch; ++c) d[c] = src[k * stride * ch + c] * (1.0f - t) + src[k1 * stride * ch + c] * t;
+        }
+    }
+}
+
+static void resampleRGBA(const unsigned char* src, int sw, int sh, unsigned char* dst, int dw, int dh) {
+    std::vector<float> in((size_t)sw * sh * 4), tmp((size_t)dw * sh * 4), out((size_t)dw * dh * 4);
+    for (size_t i = 0; i < in.size(); ++i) in[i] = src[i];
+    for (int y = 0; y < sh; ++y) resampleAxis(&in[(size_t)y * sw * 4], sw, &tmp[(size_t)y * dw * 4], dw, 1, 4);
+    for (int x = 0; x < dw; ++x) resampleAxis(&tmp[(size_t)x * 4], sh, &out[(size_t)x * 4], dh, dw, 4);
+    for (size_t i = 0; i < out.size(); ++i) dst[i] = (unsigned char)clampf(out[i] + 0.5f, 0.0f, 255.0f);
+}
+
+// decode every material, resample to a common power-of-two size and upload
+// as the layers of one array texture (missing files become white layers)
+void buildMaterialArray() {
+    unsigned char* img[MAT_LAYERS];
+    int w[MAT_LAYERS], h[MAT_LAYERS], largest = 0;
+    for (int i = 0; i < MAT_LAYERS; ++i) {
+        int ch;
+        img[i] = SOIL_load_image(kMatFile[i], &w[i], &h[i], &ch, SOIL_LOAD_RGBA);
+        g_matLoaded[i] = img[i] != NULL;
+        if (img[i]) largest = w[i] > largest ? w[i] : largest;
+        if (img[i]) largest = h[i] > largest ? h[i] : largest;
+    }
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    int size = 256;
+    while (size * 2 <= largest && size * 2 <= 1024 && size * 2 <= maxSize) size *= 2;
+    g_matSize = size;
+
+    std::vector<unsigned char> layer((size_t)size * size * 4);
+    glGenTextures(1, &g_matArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, g_matArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, MAT_LAYERS, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    for (int i = 0; i < MAT_LAYERS; ++i) {
+        if (img[i]) {
+            flipRows(img[i], w[i], h[i]);    // same orientation as SOIL_FLAG_INVERT_Y
+            resampleRGBA(img[i], w[i], h[i], layer.data(), size, size);
+            SOIL_free_image_data(img[i]);
+        }
+        else memset(layer.data(), 255, layer.size());
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, layer.data());
+    }
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    printf("Materials: %d layers at %dx%d in one texture array\n", MAT_LAYERS, size, size);
+}
+
+// CPU-side geometry builder with a small transform stack (translate /
+// rotate about Y / scale, as the immediate-mode draw functions use)
+struct BatchVertex { float px, py, pz, nx, ny, nz, u, v, layer; GLubyte r, g, b, a; };
+struct BatchBuilder {
+    std::vector<BatchVertex> v;
+    std::vector<GLushort> idx;
+    float m[16], stack[8][16];
+    int depth = 0;
+    float rgb[3] = { 1, 1, 1 }, layer = -1.0f;
+
+    BatchBuilder() { mat4Identity(m); }
+    void push() { memcpy(stack[depth++], m, sizeof(m)); }
+    void pop() { memcpy(m, stack[--depth], sizeof(m)); }
+    void translate(float x, float y, float z) { mat4Translate(m, x, y, z); }
+    void rotateY(float deg) { mat4Rotate(m, deg, 0.0f, 1.0f, 0.0f); }
+    void multMatrix(const float* w) { mat4Mul(m, m, w); }
+    void material(float r, float g, float b, int mat) { rgb[0] = r; rgb[1] = g; rgb[2] = b; layer = (float)mat; }
+    // quad corners p[4], texcoords uv[4] (ignored when untextured), face normal n
+    void quad(const float p[4][3], const float uv[4][2], const float* n) {
+        float wn[4], nx, ny, nz;
+        mat4TransformPoint(m, n[0], n[1], n[2], wn);
+        nx = wn[0] - m[12]; ny = wn[1] - m[13]; nz = wn[2] - m[14];
+        norm3(&nx, &ny, &nz);
+        GLushort base = (GLushort)v.size();
+        for (int k = 0; k < 4; ++k) {
+            float w[4];
+            mat4TransformPoint(m, p[k][0], p[k][1], p[k][2], w);
+            BatchVertex bv = { w[0], w[1], w[2], nx, ny, nz, uv[k][0], uv[k][1], layer,
+                (GLubyte)(rgb[0] * 255.0f + 0.5f), (GLubyte)(rgb[1] * 255.0f + 0.5f), (GLubyte)(rgb[2] * 255.0f + 0.5f), 255 };
+            v.push_back(bv);
+        }
+        const GLushort q[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int k = 0; k < 6; ++k) idx.push_back(base + q[k]);
+    }
+    // same faces and texcoords as drawTexturedBox
+    void box(float sx, float sy, float sz, float tu, float tv) {
+        float hx = sx * 0.5f, hy = sy * 0.5f, hz = sz * 0.5f;
+        const float uv[4][2] = { { 0, 0 }, { tu, 0 }, { tu, tv }, { 0, tv } };
+        const float f[6][4][3] = {
+            { { hx, -hy, -hz }, { hx, -hy, hz }, { hx, hy, hz }, { hx, hy, -hz } },
+            { { -hx, -hy, hz }, { -hx, -hy, -hz }, { -hx, hy, -hz }, { -hx, hy, hz } },
+            { { -hx, hy, -hz }, { hx, hy, -hz }, { hx, hy, hz }, { -hx, hy, hz } },
+            { { -hx, -hy, hz }, { hx, -hy, hz }, { hx, -hy, -hz }, { -hx, -hy, -hz } },
+            { { hx, -hy, hz }, { -hx, -hy, hz }, { -hx, hy, hz }, { hx, hy, hz } },
+            { { -hx, -hy, -hz }, { hx, -hy, -hz }, { hx, hy, -hz }, { -hx, hy, -hz } },
+        };
+        const float n[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        for (int i = 0; i < 6; ++i) quad(f[i], uv, n[i]);
+    }
+    BatchRange range(int firstIndex) const { BatchRange r = { firstIndex, (int)idx.size() - firstIndex }; return r; }
+};
+
+static void batchRoom(BatchBuilder& b) {
+    const float x0 = -ROOM_W * 0.5f, x1 = ROOM_W * 0.5f, z0 = -ROOM_D * 0.5f, z1 = ROOM_D * 0.5f, y0 = 0.0f, y1 = ROOM_H;
+    const float up[3] = { 0, 1, 0 }, down[3] = { 0, -1, 0 };
+    b.material(1, 1, 1, MAT_FLOOR);
+    const float floorP[4][3] = { { x0, y0, z0 }, { x1, y0, z0 }, { x1, y0, z1 }, { x0, y0, z1 } };
+    const float floorUV[4][2] = { { 0, 0 }, { kFloorTile, 0 }, { kFloorTile, kFloorTile }, { 0, kFloorTile } };
+    b.quad(floorP, floorUV, up);
+    b.material(1, 1, 1, MAT_CEIL);
+    const float ceilP[4][3] = { { x0, y1, z0 }, { x0, y1, z1 }, { x1, y1, z1 }, { x1, y1, z0 } };
+    const float ceilUV[4][2] = { { 0, 0 }, { kCeilTile, 0 }, { kCeilTile, kCeilTile }, { 0, kCeilTile } };
+    b.quad(ceilP, ceilUV, down);
+    b.material(1, 1, 1, MAT_WALL);
+    const float wallUV[4][2] = { { 0, 0 }, { kWallTileU, 0 }, { kWallTileU, kWallTileV }, { 0, kWallTileV } };
+    const float walls[4][4][3] = {
+        { { x1, y0, z0 }, { x1, y0, z1 }, { x1, y1, z1 }, { x1, y1, z0 } },
+        { { x0, y0, z1 }, { x0, y0, z0 }, { x0, y1, z0 }, { x0, y1, z1 } },
+        { { x0, y0, z1 }, { x1, y0, z1 }, { x1, y1, z1 }, { x0, y1, z1 } },
+        { { x1, y0, z0 }, { x0, y0, z0 }, { x0, y1, z0 }, { x1, y1, z0 } },
+    };
+    const float wallN[4][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+    for (int i = 0; i < 4; ++i) b.quad(walls[i], wallUV, wallN[i]);
+    if (!g_matLoaded[MAT_PAINTING]) return;
+
+    // painting + frame on the -Z wall
+    const float pw = kPaintingW * 0.5f, ph = kPaintingH * 0.5f, z = z0 + 0.001f, y = kPaintingY, t = kPaintingFrame;
+    const float fwd[3] = { 0, 0, 1 };
+    const float unitUV[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    b.material(1, 1, 1, MAT_PAINTING);
+    const float paint[4][3] = { { -pw, y - ph, z }, { pw, y - ph, z }, { pw, y + ph, z }, { -pw, y + ph, z } };
+    b.quad(paint, unitUV, fwd);
+    b.material(0.25f, 0.15f, 0.08f, -1);
+    const float frame[4][4][3] = {
+        { { -pw - t, y - ph - t, z }, { pw + t, y - ph - t, z }, { pw + t, y - ph, z }, { -pw - t, y - ph, z } },
+        { { -pw - t, y + ph, z }, { pw + t, y + ph, z }, { pw + t, y + ph + t, z }, { -pw - t, y + ph + t, z } },
+        { { -pw - t, y - ph, z }, { -pw, y - ph, z }, { -pw, y + ph, z }, { -pw - t, y + ph, z } },
+        { { pw, y - ph, z }, { pw + t, y - ph, z }, { pw + t, y + ph, z }, { pw, y + ph, z } },
+    };
+    for (int i = 0; i < 4; ++i) b.quad(frame[i], unitUV, fwd);
+}
+
+static void batchTable(BatchBuilder& b) {
+    int wood = g_matLoaded[MAT_WOOD];
+    if (wood) b.material(1, 1, 1, MAT_WOOD); else b.material(0.55f, 0.34f, 0.20f, -1);
+    b.push(); b.translate(0.0f, kTableHeight, 0.0f); b.box(kTableTopW, kTableTopT, kTableTopD, 1.5f, 1.0f); b.pop();
+    if (!wood) b.material(0.48f, 0.29f, 0.16f, -1);
+    const float legH = kTableHeight - kTableTopT * 0.5f;
+    const float hw = kTableTopW * 0.5f - kTableLegT * 0.5f, hd = kTableTopD * 0.5f - kTableLegT * 0.5f;
+    for (int i = 0; i < 4; ++i) {
+        b.push(); b.translate((i == 0 || i == 3) ? hw : -hw, legH * 0.5f, i < 2 ? hd : -hd);
+        b.box(kTableLegT, legH, kTableLegT, 1.0f, 1.0f); b.pop();
+    }
+}
+
+static void batchChair(BatchBuilder& b) {
+    int wood = g_matLoaded[MAT_WOOD];
+    if (wood) b.material(1, 1, 1, MAT_WOOD); else b.material(0.60f, 0.36f, 0.22f, -1);
+    b.push(); b.translate(0.0f, kChairSeatH, 0.0f); b.box(kChairSeatW, kChairSeatT, kChairSeatD, 1.0f, 1.0f); b.pop();
+    if (!wood) b.material(0.50f, 0.30f, 0.18f, -1);
+    const float legH = kChairSeatH - kChairSeatT * 0.5f;
+    const float hw = kChairSeatW * 0.5f - kChairLegT * 0.5f, hd = kChairSeatD * 0.5f - kChairLegT * 0.5f;
+    for (int i = 0; i < 4; ++i) {
+        b.push(); b.translate((i == 0 || i == 3) ? hw : -hw, legH * 0.5f, i < 2 ? hd : -hd);
+        b.box(kChairLegT, legH, kChairLegT, 1.0f, 1.0f); b.pop();
+    }
+    if (!wood) b.material(0.58f, 0.34f, 0.20f, -1);
+    b.push(); b.translate(0.0f, kChairSeatH + kChairBackH * 0.5f, -kChairSeatD * 0.5f + kChairLegT * 0.5f);
+    b.box(kChairSeatW, kChairBackH, kChairLegT, 1.0f, 1.0f); b.pop();
+}
+
+const char* kBatchVS =
+    "#version 130\n"
+    "invariant gl_Position;\n"     // shared with the depth pre-pass
+    "out vec3 vPos, vNormal, vUvw;\n"
+    "out vec4 vColor;\n"
+    "void main() {\n"
+    "    vec4 e = gl_ModelViewMatrix * gl_Vertex;\n"
+    "    vPos = e.xyz;\n"
+    "    vNormal = gl_NormalMatrix * gl_Normal;\n"
+    "    vUvw = gl_MultiTexCoord0.xyz;\n"
+    "    vColor = gl_Color;\n"
+    "    gl_Position = gl_ProjectionMatrix * e;\n"
+    "}\n";
+
+// fixed-function lighting for lights 0-1 (colour material on ambient and
+// diffuse) and GL_EXP2 fog, evaluated per pixel from the built-in GL state
+#define FIXED_FUNCTION_GLSL \
+    "vec4 fixedLighting(vec3 pos, vec3 N, vec4 color) {\n" \
+    "    vec3 V = normalize(-pos);\n" \
+    "    vec4 c = gl_LightModel.ambient * color;\n" \
+    "    for (int i = 0; i < 2; ++i) {\n" \
+    "        vec3 Lv = gl_LightSource[i].position.xyz - pos * gl_LightSource[i].position.w;\n" \
+    "        float d = length(Lv);\n" \
+    "        vec3 L = Lv / d;\n" \
+    "        float att = gl_LightSource[i].position.w == 0.0 ? 1.0 : 1.0 / (gl_LightSource[i].constantAttenuation\n" \
+    "            + gl_LightSource[i].linearAttenuation * d + gl_LightSource[i].quadraticAttenuation * d * d);\n" \
+    "        if (gl_LightSource[i].spotCutoff <= 90.0) {\n" \
+    "            float s = dot(-L, normalize(gl_LightSource[i].spotDirection));\n" \
+    "            att *= s >= gl_LightSource[i].spotCosCutoff ? pow(max(s, 0.0), gl_LightSource[i].spotExponent) : 0.0;\n" \
+    "        }\n" \
+    "        float nl = max(dot(N, L), 0.0);\n" \
+    "        c += att * (gl_LightSource[i].ambient * color + nl * gl_LightSource[i].diffuse * color);\n" \
+    "        if (nl > 0.0)\n" \
+    "            c += att * pow(max(dot(N, normalize(L + V)), 0.0), gl_FrontMaterial.shininess)\n" \
+    "                * gl_LightSource[i].specular * gl_FrontMaterial.specular;\n" \
+    "    }\n" \
+    "    return c;\n" \
+    "}\n" \
+    "vec3 fixedFog(vec3 pos, vec3 c) {\n" \
+    "    float f = clamp(exp(-pow(gl_Fog.density * length(pos), 2.0)), 0.0, 1.0);\n" \
+    "    return mix(gl_Fog.color.rgb, c, f);\n" \
+    "}\n"
+
+const char* kBatchFS =
+    "#version 130\n"
+    "uniform sampler2DArray materials;\n"
+    "uniform int fogOn;\n"
+    "in vec3 vPos, vNormal, vUvw;\n"
+    "in vec4 vColor;\n"
+    FIXED_FUNCTION_GLSL
+    "void main() {\n"
+    "    vec4 c = fixedLighting(vPos, normalize(vNormal), vColor);\n"
+    "    if (vUvw.z >= 0.0) c *= texture(materials, vUvw);\n"
+    "    if (fogOn == 1) c.rgb = fixedFog(vPos, c.rgb);\n"
+    "    gl_FragColor = vec4(c.rgb, 1.0);\n"
+    "}\n";
+
+void buildStaticBatch() {
+    g_batchSupported = GLEW_VERSION_3_0 ? 1 : 0;
+    if (g_batchSupported) g_batchProg = buildProgram(kBatchVS, kBatchFS, "static batch");
+    if (!g_batchProg) { g_batchSupported = 0; printf("Static batch: unavailable (needs GL 3.0)\n"); return; }
+    g_batchFlatProg = buildProgram(kBatchVS, kFlatFS, "static batch flat");
+    buildMaterialArray();
+
+    BatchBuilder b;
+    batchRoom(b);
+    g_batchShell = b.range(0);
+    int first = (int)b.idx.size();
+    b.push(); batchTable(b); b.pop();
+    g_batchObj[OBJ_TABLE] = b.range(first);
+    for (int i = 0; i < 4; ++i) {
+        first = (int)b.idx.size();
+        b.push(); b.multMatrix(xformWorld(XF_CHAIR0 + i)); batchChair(b); b.pop();
+        g_batchObj[OBJ_CHAIR0 + i] = b.range(first);
+    }
+
+    Mesh& m = g_batchMesh;
+    m.indexCount = (int)b.idx.size();
+    glGenBuffers(1, &m.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glBufferData(GL_ARRAY_BUFFER, b.v.size() * sizeof(BatchVertex), b.v.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &m.ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, b.idx.size() * sizeof(GLushort), b.idx.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    printf("Static batch: %d vertices, %d triangles\n", (int)b.v.size(), m.indexCount / 3);
+}
+
+// room shell in one draw, visible furniture in one multi-draw (shell last when front-to-back)
+void drawStaticBatch() {
+    DRAW_SCOPE();
+    if (g_scenePass != PASS_SHADE && g_batchFlatProg) glUseProgram(g_batchFlatProg);
+    else {
+        glUseProgram(g_batchProg);
+        glUniform1i(glGetUniformLocation(g_batchProg, "materials"), 0);
+        glUniform1i(glGetUniformLocation(g_batchProg, "fogOn"), glIsEnabled(GL_FOG) ? 1 : 0);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, g_matArray);
+    glBindBuffer(GL_ARRAY_BUFFER, g_batchMesh.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_batchMesh.ibo);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, px));
+    glNormalPointer(GL_FLOAT, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, nx));
+    glTexCoordPointer(3, GL_FLOAT, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, u));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, r));
+
+    const void* shell = (const void*)(size_t)(g_batchShell.first * sizeof(GLushort));
+    if (!g_frontToBack) glDrawElements(GL_TRIANGLES, g_batchShell.count, GL_UNSIGNED_SHORT, shell);
+    g_batchDraws = 1;
+    g_meshTris += g_batchShell.count / 3;
+    GLsizei counts[OBJ_COUNT];
+    const void* offsets[OBJ_COUNT];
+    int order[OBJ_COUNT], n = 0;
+    sceneDrawOrder(order);
+    for (int k = 0; k < OBJ_COUNT; ++k) {
+        int o = order[k];
+        if (!g_batchObj[o].count || !g_objects[o].visible) continue;
+        counts[n] = g_batchObj[o].count;
+        offsets[n] = (const void*)(size_t)(g_batchObj[o].first * sizeof(GLushort));
+        g_meshTris += counts[n] / 3;
+        ++n;
+    }
+    if (n) { glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_SHORT, offsets, n); ++g_batchDraws; }
+    if (g_frontToBack) glDrawElements(GL_TRIANGLES, g_batchShell.count, GL_UNSIGNED_SHORT, shell);
+
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glUseProgram(passProgram());
+}
+
+// ---------------- GPU-driven rendering (J) ----------------
+// Every static mesh (room shell, table, chair, Earth and lamp LODs) lives in
+// one vertex/index arena. Each scene object has a record in a storage
+// buffer; a compute pass frustum-culls the records, picks the LOD and writes
+// one DrawElementsIndirect command per object (instanceCount 0 when culled),
+// and the frame goes out in a single glMultiDrawElementsIndirect. The
+// command's baseInstance carries the object index to the vertex shader
+// through an instanced attribute. Needs GL 4.3 (runs on llvmpipe).
+enum { GOBJ_SHELL, GOBJ_TABLE, GOBJ_CHAIR0, GOBJ_EARTH = GOBJ_CHAIR0 + 4, GOBJ_CORD, GOBJ_BULB, GOBJ_SHADE, GOBJ_COUNT };
+struct GpuLod { GLuint count, firstIndex; GLint baseVertex; float err; };          // std430, 16 bytes
+struct GpuObject {                                                                 // std430, 128 bytes
+    float model[16];
+    float tint[4];      // rgb multiplies the vertex colour; w: layer override (< -1.5 = per vertex)
+    float emissive[4];
+    float bounds[4];    // local bounding sphere
+    GLuint lodFirst, lodCount;
+    float lodScale;     // world size the LOD errors are measured against
+    GLuint visible;     // CPU occlusion result
+};
+struct GpuDrawCmd { GLuint count, instanceCount, firstIndex; GLint baseVertex; GLuint baseInstance; };
+
+int g_gpuDriven_on = 1;
+int g_gpuDrivenSupported = 0;
+GLuint g_gpuCullProg = 0, g_gpuDrawProg = 0;
+GLuint g_gpuVao = 0, g_gpuVbo = 0, g_gpuIbo = 0, g_gpuIdBuf = 0;
+GLuint g_gpuLodBuf = 0, g_gpuCmdBuf = 0;
+struct { GLint materials, fogOn, objectCount; } g_gpuLoc;     // looked up once in gpuDrivenInit
+GpuObject g_gpuObjects[GOBJ_COUNT];
+StreamAlloc g_gpuObjAlloc;  // this frame's copy of the records in the streaming ring
+int g_gpuLodCount = 0;
+// Cull counters go round a small ring: each frame's buffer is fenced after
+// the dispatch and only read back GPU_STAT_RING frames later, once the fence
+// has signalled, so the stats overlay never waits on the GPU.
+#define GPU_STAT_RING 3
+GLuint g_gpuStatBuf[GPU_STAT_RING];
+GLsync g_gpuStatFence[GPU_STAT_RING];
+GLuint g_gpuStats[2];   // objects drawn, triangles (a few frames old)
+GpuTimer g_gpuCullTimer;
+
+int gpuDrivenActive() { return g_gpuDriven_on && g_gpuDrivenSupported; }
+
+const char* kGpuCullCS =
+    "#version 430\n"
+    "layout(local_size_x = 64) in;\n"
+    "struct Lod { uint count, firstIndex; int baseVertex; float err; };\n"
+    "struct Object { mat4 model; vec4 tint, emissive, bounds; uint lodFirst, lodCount; float lodScale; uint visible; };\n"
+    "struct Cmd { uint count, instanceCount, firstIndex; int baseVertex; uint baseInstance; };\n"
+    "layout(std430, binding = 0) readonly buffer Lods { Lod lods[]; };\n"
+    "layout(std430, binding = 1) readonly buffer Objects { Object objs[]; };\n"
+    "layout(std430, binding = 2) writeonly buffer Cmds { Cmd cmds[]; };\n"
+    "layout(std430, binding = 3) buffer Stats { uint drawn, tris; };\n"
+    FRAME_CONSTANTS_GLSL
+    "uniform uint objectCount;\n"
+    "void main() {\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "    if (i >= objectCount) return;\n"
+    "    mat4 m = objs[i].model;\n"
+    "    vec3 c = (m * vec4(objs[i].bounds.xyz, 1.0)).xyz;\n"
+    "    float r = objs[i].bounds.w * max(length(m[0].xyz), max(length(m[1].xyz), length(m[2].xyz)));\n"
+    "    bool vis = objs[i].visible != 0u;\n"
+    "    for (int p = 0; p < 6; ++p)\n"
+    "        if (dot(planes[p].xyz, c) + planes[p].w < -r) vis = false;\n"
+    // same rule as selectLod(): coarsest level whose projected error fits
+    "    float ppu = up.w == 1.0 ? right.w : right.w / max(dot(c - eye.xyz, fwd.xyz), fwd.w);\n"
+    "    uint pick = objs[i].lodFirst;\n"
+    "    if (params.z == 1.0)\n"
+    "        for (uint k = 0u; k < objs[i].lodCount; ++k)\n"
+    "            if (lods[objs[i].lodFirst + k].err * objs[i].lodScale * ppu <= params.y) pick = objs[i].lodFirst + k;\n"
+    "    Lod l = lods[pick];\n"
+    "    cmds[i] = Cmd(l.count, vis ? 1u : 0u, l.firstIndex, l.baseVertex, i);\n"
+    "    if (vis) { atomicAdd(drawn, 1u); atomicAdd(tris, l.count / 3u); }\n"
+    "}\n";
+
+const char* kGpuDrawVS =
+    "#version 430 compatibility\n"
+    "struct Object { mat4 model; vec4 tint, emissive, bounds; uint lodFirst, lodCount; float lodScale; uint visible; };\n"
+    "layout(std430, binding = 1) readonly buffer Objects { Object objs[]; };\n"
+    FRAME_CONSTANTS_GLSL
+    "layout(location = 0) in vec3 pos;\n"
+    "layout(location = 1) in vec3 normal;\n"
+    "layout(location = 2) in vec3 uvw;\n"
+    "layout(location = 3) in vec4 color;\n"
+    "layout(location = 4) in uint objectId;\n"
+    "invariant gl_Position;\n"
+    "out vec3 vPos, vNormal, vUvw;\n"
+    "out vec4 vColor;\n"
+    "flat out vec3 vEmissive;\n"
+    "void main() {\n"
+    "    mat4 m = objs[objectId].model;\n"
+    "    vec4 e = view * (m * vec4(pos, 1.0));\n"
+    "    vPos = e.xyz;\n"
+    "    vNormal = mat3(view) * (transpose(inverse(mat3(m))) * normal);\n"
+    "    vec4 tint = objs[objectId].tint;\n"
+    "    vUvw = vec3(uvw.xy, tint.w < -1.5 ? uvw.z : tint.w);\n"
+    "    vColor = color * vec4(tint.rgb, 1.0);\n"
+    "    vEmissive = objs[objectId].emissive.rgb;\n"
+    "    gl_Position = proj * e;\n"
+    "}\n";
+
+const char* kGpuDrawFS =
+    "#version 430 compatibility\n"
+    "uniform sampler2DArray materials;\n"
+    "uniform int fogOn;\n"
+    "in vec3 vPos, vNormal, vUvw;\n"
+    "in vec4 vColor;\n"
+    "flat in vec3 vEmissive;\n"
+    FIXED_FUNCTION_GLSL
+    "void main() {\n"
+    "    vec4 c = fixedLighting(vPos, normalize(vNormal), vColor);\n"
+    "    c.rgb += vEmissive;\n"
+    "    if (vUvw.z >= 0.0) c *= texture(materials, vUvw);\n"
+    "    if (fogOn == 1) c.rgb = fixedFog(vPos, c.rgb);\n"
+    "    gl_FragColor = vec4(c.rgb, 1.0);\n"
+    "}\n";
+
+// arena builder: meshes are appended with their own vertex range, indices
+// stay local (GLushort) and are rebased through baseVertex
+struct GpuArena {
+    std::vector<BatchVertex> v;
+    std::vector<GLushort> idx;
+    std::vector<GpuLod> lods;
+
+    int add(const std::vector<BatchVertex>& mv, const std::vector<GLushort>& mi, float err) {
+        GpuLod l = { (GLuint)mi.size(), (GLuint)idx.size(), (GLint)v.size(), err };
+        v.insert(v.end(), mv.begin(), mv.end());
+        idx.insert(idx.end(), mi.begin(), mi.end());
+        lods.push_back(l);
+        return (int)lods.size() - 1;
+    }
+    int add(const BatchBuilder& b) { return add(b.v, b.idx, 0.0f); }
+    int add(const MeshData& d) {
+        std::vector<BatchVertex> mv;
+        for (const MeshVertex& s : d.v) {
+            BatchVertex bv = { s.px, s.py, s.pz, s.nx, s.ny, s.nz, s.u, s.v, -1.0f, 255, 255, 255, 255 };
+            mv.push_back(bv);
+        }
+        return add(mv, d.idx, d.err);
+    }
+    // bounding sphere of one LOD's vertices
+    void bounds(int lod, float* out4) const {
+        const GpuLod& l = lods[lod];
+        float mn[3] = { 1e30f, 1e30f, 1e30f }, mx[3] = { -1e30f, -1e30f, -1e30f }, r2 = 0.0f;
+        for (GLuint k = 0; k < l.count; ++k) {
+            const BatchVertex& p = v[l.baseVertex + idx[l.firstIndex + k]];
+            mn[0] = fminf(mn[0], p.px); mn[1] = fminf(mn[1], p.py); mn[2] = fminf(mn[2], p.pz);
+            mx[0] = fmaxf(mx[0], p.px); mx[1] = fmaxf(mx[1], p.py); mx[2] = fmaxf(mx[2], p.pz);
+        }
+        for (int a = 0; a < 3; ++a) out4[a] = 0.5f * (mn[a] + mx[a]);
+        for (GLuint k = 0; k < l.count; ++k) {
+            const BatchVertex& p = v[l.baseVertex + idx[l.firstIndex + k]];
+            float dx = p.px - out4[0], dy = p.py - out4[1], dz = p.pz - out4[2];
+            r2 = fmaxf(r2, dx * dx + dy * dy + dz * dz);
+        }
+        out4[3] = sqrtf(r2);
+    }
+};
+
+static void gpuObjectInit(GpuObject& o, const GpuArena& a, int lodFirst, int lodCount, float lodScale,
+    float r, float g, float b, float layer) {
+    memset(&o, 0, sizeof(o));
+    mat4Identity(o.model);
+    o.tint[0] = r; o.tint[1] = g; o.tint[2] = b; o.tint[3] = layer;
+    a.bounds(lodFirst, o.bounds);
+    o.lodFirst = lodFirst; o.lodCount = lodCount; o.lodScale = lodScale;
+    o.visible = 1;
+}
+
+void gpuDrivenInit() {
+    g_gpuDrivenSupported = (GLEW_VERSION_4_3 && g_batchSupported && g_stream.buf) ? 1 : 0;
+    if (g_gpuDrivenSupported) {
+        g_gpuCullProg = buildComputeProgram(kGpuCullCS, "gpu cull");
+        g_gpuDrawProg = buildProgram(kGpuDrawVS, kGpuDrawFS, "gpu draw");
+        g_gpuFlatProg = buildProgram(kGpuDrawVS, kFlatFS, "gpu draw flat");
+    }
+    if (g_gpuCullProg && g_gpuDrawProg) {
+        g_gpuLoc.materials = glGetUniformLocation(g_gpuDrawProg, "materials");
+        g_gpuLoc.fogOn = glGetUniformLocation(g_gpuDrawProg, "fogOn");
+        g_gpuLoc.objectCount = glGetUniformLocation(g_gpuCullProg, "objectCount");
+    }
+    if (!g_gpuCullProg || !g_gpuDrawProg) {
+        g_gpuDrivenSupported = 0;
+        printf("GPU-driven: unavailable (needs GL 4.3 compute and multi-draw-indirect)\n");
+        return;
+    }
+
+    GpuArena a;
+    BatchBuilder shell, table, chair;
+    batchRoom(shell);
+    batchTable(table);
+    batchChair(chair);
+    int shellLod = a.add(shell), tableLod = a.add(table), chairLod = a.add(chair);
+    int sphereLod = -1, torusLod = -1;
+    for (int i = 0; i < SPHERE_LODS; ++i) {
+        int l = a.add(tessellateSphere(kSphereLod[i][0], kSphereLod[i][1]));
+        if (i == 0) sphereLod = l;
+    }
+    for (int i = 0; i < TORUS_LODS; ++i) {
+        int l = a.add(tessellateTorus(0.025f, 0.16f, kTorusLod[i][0], kTorusLod[i][1]));
+        if (i == 0) torusLod = l;
+    }
+    int cubeLod = a.add(tessellateCube());
+
+    const float perVertex = -2.0f;
+    gpuObjectInit(g_gpuObjects[GOBJ_SHELL], a, shellLod, 1, 1.0f, 1, 1, 1, perVertex);
+    gpuObjectInit(g_gpuObjects[GOBJ_TABLE], a, tableLod, 1, 1.0f, 1, 1, 1, perVertex);
+    for (int i = 0; i < 4; ++i) {
+        GpuObject& o = g_gpuObjects[GOBJ_CHAIR0 + i];
+        gpuObjectInit(o, a, chairLod, 1, 1.0f, 1, 1, 1, perVertex);
+        memcpy(o.model, xformWorld(XF_CHAIR0 + i), sizeof(o.model));
+    }
+    gpuObjectInit(g_gpuObjects[GOBJ_EARTH], a, sphereLod, SPHERE_LODS, 0.18f, 1, 1, 1, (float)MAT_EARTH);
+    gpuObjectInit(g_gpuObjects[GOBJ_CORD], a, cubeLod, 1, 1.0f, 0.2f, 0.2f, 0.2f, -1.0f);
+    gpuObjectInit(g_gpuObjects[GOBJ_BULB], a, sphereLod + 2, SPHERE_LODS - 2, 0.08f, 1.0f, 1.0f, 0.85f, -1.0f);
+    gpuObjectInit(g_gpuObjects[GOBJ_SHADE], a, torusLod, TORUS_LODS, 1.0f, 0.85f, 0.82f, 0.78f, -1.0f);
+    g_gpuLodCount = (int)a.lods.size();
+
+    std::vector<GLuint> ids(GOBJ_COUNT);
+    for (int i = 0; i < GOBJ_COUNT; ++i) ids[i] = i;
+    glGenVertexArrays(1, &g_gpuVao);
+    glBindVertexArray(g_gpuVao);
+    glGenBuffers(1, &g_gpuVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, g_gpuVbo);
+    glBufferData(GL_ARRAY_BUFFER, a.v.size() * sizeof(BatchVertex), a.v.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, px));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, nx));
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, u));
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BatchVertex), (const void*)offsetof(BatchVertex, r));
+    for (int i = 0; i < 4; ++i) glEnableVertexAttribArray(i);
+    glGenBuffers(1, &g_gpuIdBuf);
+    glBindBuffer(GL_ARRAY_BUFFER, g_gpuIdBuf);
+    glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(GLuint), (const void*)0);
+    glVertexAttribDivisor(4, 1);     // advanced by the command's baseInstance
+    glEnableVertexAttribArray(4);
+    glGenBuffers(1, &g_gpuIbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_gpuIbo);    // captured by the VAO
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, a.idx.size() * sizeof(GLushort), a.idx.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &g_gpuLodBuf);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gpuLodBuf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, a.lods.size() * sizeof(GpuLod), a.lods.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &g_gpuCmdBuf);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gpuCmdBuf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GOBJ_COUNT * sizeof(GpuDrawCmd), NULL, GL_DYNAMIC_COPY);
+    glGenBuffers(GPU_STAT_RING, g_gpuStatBuf);
+    for (int i = 0; i < GPU_STAT_RING; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_gpuStatBuf[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(g_gpuStats), NULL, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    printf("GPU-driven: %d objects, %d meshes/LODs, %d vertices, %d indices in one arena\n",
+        GOBJ_COUNT, g_gpuLodCount, (int)a.v.size(), (int)a.idx.size());
+}
+
+// per-frame record updates: animated transforms, emission and occlusion results
+static void gpuUpdateObjects() {
+    GpuObject* o = g_gpuObjects;
+    o[GOBJ_TABLE].visible = g_objects[OBJ_TABLE].visible;
+    for (int i = 0; i < 4; ++i) o[GOBJ_CHAIR0 + i].visible = g_objects[OBJ_CHAIR0 + i].visible;
+    o[GOBJ_EARTH].visible = g_objects[OBJ_EARTH].visible && g_matLoaded[MAT_EARTH];
+    memcpy(o[GOBJ_EARTH].model, xformWorld(XF_EARTH), sizeof(o->model));
+    mat4Scale(o[GOBJ_EARTH].model, 0.18f, 0.18f, 0.18f);
+    memcpy(o[GOBJ_CORD].model, xformWorld(XF_CORD), sizeof(o->model));
+    memcpy(o[GOBJ_BULB].model, xformWorld(XF_BULB_MESH), sizeof(o->model));
+    memcpy(o[GOBJ_SHADE].model, xformWorld(XF_SHADE), sizeof(o->model));
+    o[GOBJ_BULB].emissive[0] = 1.0f * g_flicker;
+    o[GOBJ_BULB].emissive[1] = 0.96f * g_flicker;
+    o[GOBJ_BULB].emissive[2] = 0.85f * g_flicker;
+    for (int i = GOBJ_CORD; i <= GOBJ_SHADE; ++i) o[i].visible = g_objects[OBJ_LAMP].visible;
+
+    g_gpuObjAlloc = streamAlloc(sizeof(g_gpuObjects), g_stream.ssboAlign);
+    if (!g_gpuObjAlloc.ptr) return;
+    if (!g_frontToBack) { memcpy(g_gpuObjAlloc.ptr, g_gpuObjects, sizeof(g_gpuObjects)); return; }
+    // the multi-draw runs in record order (each command's baseInstance names
+    // its own slot), so front-to-back just permutes the uploaded records
+    int order[OBJ_COUNT], n = 0;
+    GpuObject* dst = (GpuObject*)g_gpuObjAlloc.ptr;
+    sceneDrawOrder(order);
+    for (int k = 0; k < OBJ_COUNT; ++k) {
+        int first = order[k] == OBJ_LAMP ? GOBJ_CORD : order[k] == OBJ_EARTH ? GOBJ_EARTH : GOBJ_TABLE + order[k];
+        int last = order[k] == OBJ_LAMP ? GOBJ_SHADE : first;
+        for (int i = first; i <= last; ++i) dst[n++] = o[i];
+    }
+    dst[n] = o[GOBJ_SHELL];
+}
+
+// one submission for everything
+static void gpuDrawCommands() {
+    GLuint p = g_gpuDrawProg;
+    if (g_scenePass != PASS_SHADE && g_gpuFlatProg) glUseProgram(p = g_gpuFlatProg);
+    else {
+        glUseProgram(p);
+        glUniform1i(g_gpuLoc.materials, 0);
+        glUniform1i(g_gpuLoc.fogOn, glIsEnabled(GL_FOG) ? 1 : 0);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, g_matArray);
+    glBindVertexArray(g_gpuVao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, g_gpuCmdBuf);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, (const void*)0, GOBJ_COUNT, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glUseProgram(passProgram());
+}
+
+void drawGpuScene() {
+    DRAW_SCOPE();
+    if (g_prepassDone) { gpuDrawCommands(); return; }    // culled for the depth pass already
+    int slot = g_frameIndex % GPU_STAT_RING;
+    GLuint statBuf = g_gpuStatBuf[slot];
+    GLsync& fence = g_gpuStatFence[slot];
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, statBuf);
+    if (fence) {    // this slot's last counters, read only if they are already done
+        if (showStats && glClientWaitSync(fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(g_gpuStats), g_gpuStats);
+        glDeleteSync(fence);
+        fence = 0;
+    }
+    GLuint zero[2] = { 0, 0 };
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    gpuUpdateObjects();
+    if (!g_gpuObjAlloc.ptr) return;
+
+    // cull + LOD (camera and LOD settings come from the frame constants)
+    gpuTimerBegin(g_gpuCullTimer);
+    GLuint p = g_gpuCullProg;
+    glUseProgram(p);
+    glUniform1ui(g_gpuLoc.objectCount, GOBJ_COUNT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_gpuLodBuf);
+    streamBind(GL_SHADER_STORAGE_BUFFER, 1, g_gpuObjAlloc);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, g_gpuCmdBuf);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, statBuf);
+    glDispatchCompute((GOBJ_COUNT + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gpuTimerEnd(g_gpuCullTimer);
+    gpuDrawCommands();
+}
+
+// ---------------- Frame capture (C: screenshot, V: continuous) ----------------
+// Readback goes through a small ring of pixel-pack buffers. A frame's
+// glReadPixels only queues the copy; a fence tells us a few frames later
+// that the PBO can be mapped without stalling. The mapped pixels are copied
+// into a pooled CPU buffer and writer threads do encoding and disk I/O.
+// Interactively, a full ring or pool drops the frame rather than waiting;
+// image sequences (offline rendering) wait instead.
+#define CAPTURE_RING 3
+#define CAPTURE_POOL 8
+#define CAPTURE_DIR "captures"
+
+enum { CAP_SHOT, CAP_STREAM, CAP_SEQUENCE };
+struct CaptureSlot { GLuint pbo; GLsync fence; int w, h, frame, kind; size_t size; };
+struct CaptureJob { int buffer, w, h, frame, kind; };
+struct CaptureStats { int issued, dropped, failed; float mapMs; };   // failed: the fence wait errored
+
+CaptureSlot g_capSlots[CAPTURE_RING];
+int g_capNext = 0;            // next slot to issue into (= oldest in flight)
+int g_capSupported = 0;
+int g_captureOne = 0;         // C: grab the next frame as PNG
+int g_captureContinuous = 0;  // V: grab every frame as raw RGBA
+int g_capShot = 0, g_capFrame = 0;
+const char* g_capSeqDir = CAPTURE_DIR;  // image sequence output
+int g_capSeqRaw = 0;                    // sequence as raw RGBA instead of PNG
+CaptureStats g_capStats;
+std::atomic<int> g_capWritten{ 0 };  // bumped by the writer threads
+std::atomic<int> g_capWriteErrors{ 0 };
+
+std::vector<unsigned char> g_capBuffers[CAPTURE_POOL];
+std::vector<int> g_capFree;          // pool indices not owned by a job
+CaptureJob g_capQueue[CAPTURE_POOL]; // handed to the writers; each job owns a pool buffer, so it never overflows
+int g_capQueueHead = 0, g_capQueueCount = 0;
+std::mutex g_capMutex;
+std::condition_variable g_capWake, g_capFreed;
+std::vector<std::thread> g_capThreads;
+bool g_capQuit = false;
+
+static int captureWriteJob(const CaptureJob& j) {
+    unsigned char* px = g_capBuffers[j.buffer].data();
+    char path[512];
+    int raw = (j.kind == CAP_STREAM) || (j.kind == CAP_SEQUENCE && g_capSeqRaw);
+    if (j.kind == CAP_SHOT) snprintf(path, sizeof(path), CAPTURE_DIR "/shot_%04d.png", j.frame);
+    else if (j.kind == CAP_STREAM) snprintf(path, sizeof(path), CAPTURE_DIR "/frame_%06d_%dx%d.rgba", j.frame, j.w, j.h);
+    else if (raw) snprintf(path, sizeof(path), "%s/frame_%06d_%dx%d.rgba", g_capSeqDir, j.frame, j.w, j.h);
+    else snprintf(path, sizeof(path), "%s/frame_%06d.png", g_capSeqDir, j.frame);
+
+    if (!raw) {
+        flipRows(px, j.w, j.h); // GL rows are bottom-up
+        if (!SOIL_save_image(path, SOIL_SAVE_TYPE_PNG, j.w, j.h, 4, px)) {
+            printf("Capture: failed to write '%s' : %s\n", path, SOIL_last_result());
+            return 0;
+        }
+        if (j.kind == CAP_SHOT) printf("Capture: wrote '%s'\n", path);
+        return 1;
+    }
+    // raw RGBA, bottom-up rows, size in the name
+    FILE* f = fopen(path, "wb");
+    size_t size = (size_t)j.w * j.h * 4;
+    int ok = f && fwrite(px, 1, size, f) == size;
+    if (f && fclose(f)) ok = 0;
+    if (!ok) printf("Capture: failed to write '%s'\n", path);
+    return ok;
+}
+
+static void captureWriterLoop() {
+    PROFILE_THREAD("capture writer");
+    for (;;) {
+        CaptureJob j;
+        {
+            std::unique_lock<std::mutex> lk(g_capMutex);
+            g_capWake.wait(lk, [] { return g_capQuit || g_capQueueCount > 0; });
+            if (!g_capQueueCount) return;   // quit once drained
+            j = g_capQueue[g_capQueueHead];
+            g_capQueueHead = (g_capQueueHead + 1) % CAPTURE_POOL;
+            g_capQueueCount--;
+        }
+        int ok;
+        {
+            PROFILE_ZONE("captureWriteJob");
+            ok = captureWriteJob(j);
+        }
+        {
+            std::lock_guard<std::mutex> lk(g_capMutex);
+            g_capFree.push_back(j.buffer);
+        }
+        g_capFreed.notify_one();
+        if (ok) g_capWritten++;
+        else g_capWriteErrors++;
+    }
+}
+
+void captureInit(int writers) {
+    g_capSupported = (GLEW_VERSION_3_2 || GLEW_ARB_sync) ? 1 : 0;
+    if (!g_capSupported) { printf("Capture: needs GL 3.2 / ARB_sync, disabled\n"); return; }
+    for (int i = 0; i < CAPTURE_RING; ++i) {
+        memset(&g_capSlots[i], 0, sizeof(CaptureSlot));
+        glGenBuffers(1, &g_capSlots[i].pbo);
+    }
+    for (int i = 0; i < CAPTURE_POOL; ++i) g_capFree.push_back(i);
+    makeDir(CAPTURE_DIR);
+    for (int i = 0; i < writers; ++i) g_capThreads.emplace_back(captureWriterLoop);
+}
+
+// Map readbacks whose fence has signalled and hand them to the writers.
+// With block set, waits for every fence, however long the GPU takes, and
+// for a free buffer.
+void captureCollect(int block) {
+    PROFILE_FUNCTION();
+    double t0 = nowMs();
+    for (int n = 0; n < CAPTURE_RING; ++n) {
+        CaptureSlot& s = g_capSlots[(g_capNext + n) % CAPTURE_RING]; // oldest first
+        if (!s.fence) continue;
+        GLenum r = glClientWaitSync(s.fence, block ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, block ? 1000000000ull : 0);
+        while (block && r == GL_TIMEOUT_EXPIRED) r = glClientWaitSync(s.fence, 0, 1000000000ull);
+        if (r == GL_TIMEOUT_EXPIRED) break;
+        glDeleteSync(s.fence); s.fence = 0;
+        if (r == GL_WAIT_FAILED) {
+            printf("Capture: fence wait failed, frame %d lost\n", s.frame);
+            g_capStats.failed++;
+            continue;
+        }
+
+        int buffer = -1;
+        {
+            std::unique_lock<std::mutex> lk(g_capMutex);
+            if (block) g_capFreed.wait(lk, [] { return !g_capFree.empty(); });
+            if (!g_capFree.empty()) { buffer = g_capFree.back(); g_capFree.pop_back(); }
+        }
+        if (buffer < 0) { g_capStats.dropped++; continue; } // writers are behind
+        if (g_capBuffers[buffer].capacity() < s.size) ALLOC_CHECK_SETTLE();
+        g_capBuffers[buffer].resize(s.size);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+        void* src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, s.size, GL_MAP_READ_BIT);
+        if (src) memcpy(g_capBuffers[buffer].data(), src, s.size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        CaptureJob j = { buffer, s.w, s.h, s.frame, s.kind };
+        {
+            std::lock_guard<std::mutex> lk(g_capMutex);
+            g_capQueue[(g_capQueueHead + g_capQueueCount++) % CAPTURE_POOL] = j;
+        }
+        g_capWake.notify_one();
+    }
+    float ms = (float)(nowMs() - t0);
+    g_capStats.mapMs += (ms - g_capStats.mapMs) * 0.1f;
+}
+
+// queue an asynchronous readback of the bound read framebuffer
+int captureRead(int w, int h, int kind, int frame, int block) {
+    CaptureSlot& s = g_capSlots[g_capNext];
+    if (s.fence && block) captureCollect(1);
+    if (s.fence) { g_capStats.dropped++; return 0; } // ring full
+    size_t size = (size_t)w * h * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+    if (size != s.size) { glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ); s.size = size; }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    s.w = w; s.h = h; s.kind = kind; s.frame = frame;
+    g_capNext = (g_capNext + 1) % CAPTURE_RING;
+    g_capStats.issued++;
+    return 1;
+}
+
+// wait until every readback has been handed to the writers
+void captureFlush() {
+    for (int i = 0; i < CAPTURE_RING; ++i)
+        if (g_capSlots[i].fence) captureCollect(1);
+}
+
+void captureShutdown() {
+    if (g_capThreads.empty()) return;
+    captureFlush();     // readbacks still in the ring, e.g. a screenshot taken just before quitting
+    { std::lock_guard<std::mutex> lk(g_capMutex); g_capQuit = true; }
+    g_capWake.notify_all();
+    for (auto& t : g_capThreads) t.join();
+    g_capThreads.clear();
+}
+
+// interactive capture of the back buffer (C / V)
+void captureIssue(int w, int h) {
+    if (!g_capSupported) return;
+    if (g_captureOne) {     // kept while the ring is full, so the shot goes out next frame
+        if (captureRead(w, h, CAP_SHOT, g_capShot + 1, 0)) { g_captureOne = 0; g_capShot++; }
+    }
+    else if (g_captureContinuous) captureRead(w, h, CAP_STREAM, ++g_capFrame, 0);
+}
+
+// ---------------- Dynamic resolution (G) ----------------
+// The scene is drawn into the lower-left part of the offscreen scene target.
+// The part's size comes from a PID-style controller chasing a GPU frame-time
+// target; the composite pass below upscales it to the window with a
+// Catmull-Rom filter, and the text overlay is drawn afterwards at native
+// resolution.
+struct DynResController { float scale, err1, err2; };
+int g_dynres_on = 0;
+float g_dynresTargetMs = 14.0f;     // GPU budget per frame
+const float kDynresMin = 0.5f, kDynresMax = 1.0f;
+DynResController g_dynres = { 1.0f, 0.0f, 0.0f };
+GpuTimer g_gpuFrame;
+
+// velocity-form PID on the normalised headroom; the measurement lags a few
+// frames (timer readback), so the gains are kept small
+void dynresUpdate(float measuredMs) {
+    const float kp = 0.08f, ki = 0.04f, kd = 0.02f;
+    float e = clampf((g_dynresTargetMs - measuredMs) / g_dynresTargetMs, -1.0f, 1.0f);
+    float du = kp * (e - g_dynres.err1) + ki * e + kd * (e - 2.0f * g_dynres.err1 + g_dynres.err2);
+    g_dynres.err2 = g_dynres.err1; g_dynres.err1 = e;
+    g_dynres.scale = clampf(g_dynres.scale + du, kDynresMin, kDynresMax);
+}
+
+// ---------------- Anti-aliasing (F8) ----------------
+// MSAA renders the scene into a multisampled framebuffer and resolves it with
+// a blit; FXAA and SMAA are post passes over the resolved scene target. The
+// window itself is single-sampled, so the mode here is the only source of AA.
+// SMAA is a reduced variant: luma edges with local contrast adaptation, an
+// analytic line-coverage estimate in place of the precomputed area/search
+// textures, and no diagonal or corner handling.
+enum { AA_NONE, AA_MSAA2, AA_MSAA4, AA_MSAA8, AA_FXAA, AA_SMAA, AA_MODES };
+const char* kAaModeName[AA_MODES] = { "off", "MSAA 2x", "MSAA 4x", "MSAA 8x", "FXAA", "SMAA" };
+const int kAaSamples[AA_MODES] = { 0, 2, 4, 8, 0, 0 };
+int g_aaMode = AA_MSAA4;
+int g_aaMaxSamples = 0;
+GLuint g_fxaaProg = 0, g_smaaEdgeProg = 0, g_smaaWeightProg = 0, g_smaaBlendProg = 0;
+GLuint g_msaaFbo = 0, g_msaaColor = 0, g_msaaDepth = 0;
+int g_msaaW = 0, g_msaaH = 0, g_msaaSamples = 0;
+RenderTarget g_aaRT, g_smaaEdgeRT, g_smaaWeightRT;
+GpuTimer g_gpuAA;
+float g_aaFrameMs[AA_MODES];        // GPU frame time measured while each mode was active (0: not yet)
+unsigned g_aaSwitchFrame = 0;
+
+// all passes address the scene sub-rectangle in pixels via gl_FragCoord
+#define AA_PIXEL_TAP \
+    "uniform sampler2D src;\n" \
+    "uniform vec2 texel;      // 1 / texture size\n" \
+    "uniform vec2 srcSize;    // rendered sub-rectangle in pixels\n" \
+    "vec3 tap(vec2 p) { return texture2D(src, clamp(p, vec2(0.5), srcSize - 0.5) * texel).rgb; }\n"
+
+const char* kFxaaFS =
+    "#version 120\n"
+    AA_PIXEL_TAP
+    "float luma(vec3 c) { return dot(c, vec3(0.299, 0.587, 0.114)); }\n"
+    "void main() {\n"
+    "    vec2 p = gl_FragCoord.xy;\n"
+    "    vec3 m = tap(p);\n"
+    "    float lNW = luma(tap(p + vec2(-1.0, 1.0))), lNE = luma(tap(p + vec2(1.0, 1.0)));\n"
+    "    float lSW = luma(tap(p + vec2(-1.0, -1.0))), lSE = luma(tap(p + vec2(1.0, -1.0)));\n"
+    "    float lM = luma(m);\n"
+    "    float lMin = min(lM, min(min(lNW, lNE), min(lSW, lSE)));\n"
+    "    float lMax = max(lM, max(max(lNW, lNE), max(lSW, lSE)));\n"
+    "    // blur along the edge: perpendicular to the luma gradient\n"
+    "    vec2 dir = vec2(-((lNW + lNE) - (lSW + lSE)), (lNE + lSE) - (lNW + lSW));\n"
+    "    float reduce = max((lNW + lNE + lSW + lSE) * (0.25 / 8.0), 1.0 / 128.0);\n"
+    "    dir = clamp(dir / (min(abs(dir.x), abs(dir.y)) + reduce), -8.0, 8.0);\n"
+    "    vec3 a = 0.5 * (tap(p + dir * (1.0 / 3.0 - 0.5)) + tap(p + dir * (2.0 / 3.0 - 0.5)));\n"
+    "    vec3 b = a * 0.5 + 0.25 * (tap(p - dir * 0.5) + tap(p + dir * 0.5));\n"
+    "    float lB = luma(b);\n"
+    "    gl_FragColor = vec4((lB < lMin || lB > lMax) ? a : b, 1.0);\n"
+    "}\n";
+
+// r: edge with the left neighbour, g: edge with the neighbour above
+const char* kSmaaEdgeFS =
+    "#version 120\n"
+    AA_PIXEL_TAP
+    "float L(vec2 p) { return dot(tap(p), vec3(0.2126, 0.7152, 0.0722)); }\n"
+    "void main() {\n"
+    "    vec2 p = gl_FragCoord.xy;\n"
+    "    float l = L(p), lL = L(p + vec2(-1.0, 0.0)), lT = L(p + vec2(0.0, 1.0));\n"
+    "    vec2 d = abs(l - vec2(lL, lT));\n"
+    "    vec2 e = step(0.1, d);\n"
+    "    if (e.x + e.y > 0.0) {\n"
+    "        // local contrast adaptation: drop edges much weaker than their neighbours\n"
+    "        float lR = L(p + vec2(1.0, 0.0)), lB = L(p + vec2(0.0, -1.0));\n"
+    "        float lLL = L(p + vec2(-2.0, 0.0)), lTT = L(p + vec2(0.0, 2.0));\n"
+    "        float m = max(max(d.x, d.y), max(max(abs(l - lR), abs(l - lB)), max(abs(lL - lLL), abs(lT - lTT))));\n"
+    "        e *= step(0.5 * m, d);\n"
+    "    }\n"
+    "    gl_FragColor = vec4(e, 0.0, 1.0);\n"
+    "}\n";
+
+// Per edge, search both ways to its ends (up to 16 px), look for the crossing
+// edges there and estimate how far the reconstructed line reaches into each
+// pixel. r/g: blend weights across the top edge for the pixel above / this
+// pixel; b/a: across the left edge for the left pixel / this pixel.
+const char* kSmaaWeightFS =
+    "#version 120\n"
+    "uniform sampler2D src;\n"
+    "uniform vec2 texel;\n"
+    "uniform vec2 srcSize;\n"
+    "vec2 E(vec2 p) {\n"
+    "    if (p.x < 0.0 || p.y < 0.0 || p.x > srcSize.x || p.y > srcSize.y) return vec2(0.0);\n"
+    "    return texture2D(src, p * texel).rg;\n"
+    "}\n"
+    "float crossing(float a, float b) { return a > 0.5 && b < 0.5 ? 1.0 : (b > 0.5 && a < 0.5 ? -1.0 : 0.0); }\n"
+    "// signed height of the line (+: into the far side) at distance d1 from one end\n"
+    "float coverage(float d1, float d2, float c1, float c2) {\n"
+    "    float len = d1 + d2 + 1.0, x = d1 + 0.5;\n"
+    "    if (c1 == c2) return 0.5 * c1 * max(0.0, 1.0 - 2.0 * min(x, len - x) / len);\n"
+    "    return mix(0.5 * c1, 0.5 * c2, x / len);\n"
+    "}\n"
+    "void main() {\n"
+    "    vec2 p = gl_FragCoord.xy;\n"
+    "    vec2 e = E(p);\n"
+    "    vec4 w = vec4(0.0);\n"
+    "    if (e.g > 0.5) {\n"
+    "        float d1 = 0.0, d2 = 0.0;\n"
+    "        for (int i = 1; i < 16; ++i) { if (E(p - vec2(i, 0.0)).g < 0.5) break; d1 = float(i); }\n"
+    "        for (int i = 1; i < 16; ++i) { if (E(p + vec2(i, 0.0)).g < 0.5) break; d2 = float(i); }\n"
+    "        vec2 pl = p - vec2(d1, 0.0), pr = p + vec2(d2, 0.0);\n"
+    "        float c1 = crossing(E(pl + vec2(0.0, 1.0)).r, E(pl).r);\n"
+    "        float c2 = crossing(E(pr + vec2(1.0, 1.0)).r, E(pr + vec2(1.0, 0.0)).r);\n"
+    "        float h = coverage(d1, d2, c1, c2);\n"
+    "        w.rg = vec2(max(h, 0.0), max(-h, 0.0));\n"
+    "    }\n"
+    "    if (e.r > 0.5) {\n"
+    "        float d1 = 0.0, d2 = 0.0;\n"
+    "        for (int i = 1; i < 16; ++i) { if (E(p - vec2(0.0, i)).r < 0.5) break; d1 = float(i); }\n"
+    "        for (int i = 1; i < 16; ++i) { if (E(p + vec2(0.0, i)).r < 0.5) break; d2 = float(i); }\n"
+    "        vec2 pb = p - vec2(0.0, d1), pt = p + vec2(0.0, d2);\n"
+    "        float c1 = crossing(E(pb + vec2(-1.0, -1.0)).g, E(pb + vec2(0.0, -1.0)).g);\n"
+    "        float c2 = crossing(E(pt + vec2(-1.0, 0.0)).g, E(pt).g);\n"
+    "        float h = coverage(d1, d2, c1, c2);\n"
+    "        w.ba = vec2(max(h, 0.0), max(-h, 0.0));\n"
+    "    }\n"
+    "    gl_FragColor = w;\n"
+    "}\n";
+
+const char* kSmaaBlendFS =
+    "#version 120\n"
+    AA_PIXEL_TAP
+    "uniform sampler2D weights;\n"
+    "vec4 W(vec2 p) { return texture2D(weights, clamp(p, vec2(0.5), srcSize - 0.5) * texel); }\n"
+    "void main() {\n"
+    "    vec2 p = gl_FragCoord.xy;\n"
+    "    vec4 w = W(p);\n"
+    "    float wT = w.g, wL = w.a, wB = W(p - vec2(0.0, 1.0)).r, wR = W(p + vec2(1.0, 0.0)).b;\n"
+    "    float sum = wT + wL + wB + wR;\n"
+    "    vec3 c = tap(p);\n"
+    "    if (sum > 0.0) {\n"
+    "        vec3 n = wT * tap(p + vec2(0.0, 1.0)) + wB * tap(p - vec2(0.0, 1.0))\n"
+    "               + wL * tap(p - vec2(1.0, 0.0)) + wR * tap(p + vec2(1.0, 0.0));\n"
+    "        c = sum > 1.0 ? n / sum : c * (1.0 - sum) + n;\n"
+    "    }\n"
+    "    gl_FragColor = vec4(c, 1.0);\n"
+    "}\n";
+
+int aaSupported(int mode) {
+    if (kAaSamples[mode]) return kAaSamples[mode] <= g_aaMaxSamples;
+    if (mode == AA_FXAA) return g_fxaaProg != 0;
+    if (mode == AA_SMAA) return g_smaaEdgeProg && g_smaaWeightProg && g_smaaBlendProg;
+    return 1;
+}
+
+// offscreen: the scene target / post path is available (every mode needs it)
+void aaInit(int offscreen) {
+    if (offscreen) {
+        glGetIntegerv(GL_MAX_SAMPLES, &g_aaMaxSamples);
+        g_fxaaProg = buildProgram(kFullscreenVS, kFxaaFS, "fxaa");
+        g_smaaEdgeProg = buildProgram(kFullscreenVS, kSmaaEdgeFS, "smaa-edges");
+        g_smaaWeightProg = buildProgram(kFullscreenVS, kSmaaWeightFS, "smaa-weights");
+        g_smaaBlendProg = buildProgram(kFullscreenVS, kSmaaBlendFS, "smaa-blend");
+    }
+    printf("Anti-aliasing: up to %dx MSAA, FXAA %s, SMAA %s\n", g_aaMaxSamples, g_fxaaProg ? "yes" : "no",
+        g_smaaEdgeProg && g_smaaWeightProg && g_smaaBlendProg ? "yes" : "no");
+    if (!aaSupported(g_aaMode)) g_aaMode = AA_NONE;
+}
+
+void aaCycle() {
+    do g_aaMode = (g_aaMode + 1) % AA_MODES; while (!aaSupported(g_aaMode));
+    g_aaSwitchFrame = g_frameIndex;
+}
+
+static void destroyMsaaTarget() {
+    if (g_msaaFbo) glDeleteFramebuffers(1, &g_msaaFbo);
+    if (g_msaaColor) glDeleteRenderbuffers(1, &g_msaaColor);
+    if (g_msaaDepth) glDeleteRenderbuffers(1, &g_msaaDepth);
+    g_msaaFbo = g_msaaColor = g_msaaDepth = 0;
+    g_msaaW = g_msaaH = g_msaaSamples = 0;
+}
+
+static int createMsaaTarget(int w, int h, int samples) {
+    destroyMsaaTarget();
+    glGenRenderbuffers(1, &g_msaaColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, g_msaaColor);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, w, h);
+    glGenRenderbuffers(1, &g_msaaDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, g_msaaDepth);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &g_msaaFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, g_msaaFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, g_msaaColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_msaaDepth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("MSAA %dx target %dx%d incomplete (0x%x)\n", samples, w, h, status);
+        destroyMsaaTarget();
+        return 0;
+    }
+    g_msaaW = w; g_msaaH = h; g_msaaSamples = samples;
+    return 1;
+}
+
+// bind the multisampled scene framebuffer when an MSAA mode is active
+// (w x h: full scene target size)
+int aaBegin(int w, int h) {
+    int samples = kAaSamples[g_aaMode];
+    if (!samples) return 0;
+    if ((g_msaaW != w || g_msaaH != h || g_msaaSamples != samples) && !createMsaaTarget(w, h, samples)) {
+        g_aaMode = AA_NONE;
+        return 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, g_msaaFbo);
+    return 1;
+}
+
+static void aaPass(GLuint prog, const RenderTarget& src, const RenderTarget& dst, int w, int h) {
+    glBindFramebuffer(GL_FRAMEBUFFER, dst.fbo);
+    glViewport(0, 0, w, h);
+    glUseProgram(prog);
+    glBindTexture(GL_TEXTURE_2D, src.color);
+    glUniform1i(glGetUniformLocation(prog, "src"), 0);
+    glUniform2f(glGetUniformLocation(prog, "texel"), 1.0f / src.w, 1.0f / src.h);
+    glUniform2f(glGetUniformLocation(prog, "srcSize"), (float)w, (float)h);
+    drawFullscreenQuad();
+}
+
+// resolve / filter the w x h sub-rectangle of the scene target; returns the
+// target holding the anti-aliased image
+const RenderTarget* aaResolve(const RenderTarget& scene, int w, int h) {
+    const RenderTarget* out = &scene;
+    gpuTimerBegin(g_gpuAA);
+    if (kAaSamples[g_aaMode] && g_msaaFbo) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, g_msaaFbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scene.fbo);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+    else if (g_aaMode == AA_FXAA || g_aaMode == AA_SMAA) {
+        int ok = g_aaRT.w == scene.w && g_aaRT.h == scene.h;
+        if (!ok) {
+            ok = createRenderTarget(g_aaRT, scene.w, scene.h, 0) &&
+                createRenderTarget(g_smaaEdgeRT, scene.w, scene.h, 0) &&
+                createRenderTarget(g_smaaWeightRT, scene.w, scene.h, 0);
+        }
+        if (ok && g_aaMode == AA_FXAA) {
+            aaPass(g_fxaaProg, scene, g_aaRT, w, h);
+            out = &g_aaRT;
+        }
+        else if (ok) {
+            aaPass(g_smaaEdgeProg, scene, g_smaaEdgeRT, w, h);
+            aaPass(g_smaaWeightProg, g_smaaEdgeRT, g_smaaWeightRT, w, h);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, g_smaaWeightRT.color);
+            glActiveTexture(GL_TEXTURE0);
+            glUseProgram(g_smaaBlendProg);
+            glUniform1i(glGetUniformLocation(g_smaaBlendProg, "weights"), 1);
+            aaPass(g_smaaBlendProg, scene, g_aaRT, w, h);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glActiveTexture(GL_TEXTURE0);
+            out = &g_aaRT;
+        }
+    }
+    gpuTimerEnd(g_gpuAA);
+    return out;
+}
+
+// record the GPU frame time against the active mode once the timer readback
+// (GPU_TIMER_LAG frames late) no longer covers frames from the previous mode
+void aaRecordFrame(float gpuMs) {
+    if (g_frameIndex - g_aaSwitchFrame <= GPU_TIMER_LAG + 1 || gpuMs <= 0.0f) return;
+    float& m = g_aaFrameMs[g_aaMode];
+    m = m > 0.0f ? m + (gpuMs - m) * 0.05f : gpuMs;
+}
+
+// ---------------- Volumetric fog (F) ----------------
+// Froxel fog: a view-aligned 160x90x64 grid (exponential depth slices) gets
+// the bulb's and the spotlight's in-scattering injected by a compute shader,
+// blended with the previous frame's grid (reprojected through last frame's
+// view-projection), then integrated front to back along each column. The
+// composite pass applies it with a single 3D lookup per pixel at the scene
+// depth, so the cost follows the grid size rather than the resolution.
+// Needs compute shaders (GL 4.3) and a perspective camera; otherwise the
+// fixed-function GL_EXP2 fog stays in use. No shadowing: light passes
+// through geometry inside the volume.
+const int kFogGrid[3] = { 160, 90, 64 };
+#define VOLFOG_JITTER_FRAMES 8      // length of the depth jitter cycle
+int g_volfog_on = 1;
+int g_volfogSupported = 0;
+int g_volfogTemporal = 1;           // off for offline renders (each frame must not depend on its predecessors)
+float g_volfogDensity = 0.025f;     // extinction per unit at floor height
+float g_volfogFar = 20.0f;          // the grid ends here (the room is ~12 units corner to corner)
+GLuint g_fogInjectProg = 0, g_fogIntegrateProg = 0;
+GLuint g_fogScatter[2] = { 0, 0 }, g_fogIntegrated = 0;
+int g_fogCurrent = 0, g_fogHistoryValid = 0;
+float g_fogPrevViewProj[16];
+GpuTimer g_gpuFog;
+
+const char* kFogInjectCS =
+    "#version 430\n"
+    "layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;\n"
+    "layout(rgba16f, binding = 0) uniform writeonly image3D scatterOut;\n"
+    "uniform sampler3D history;\n"
+    "uniform vec3 gridSize;\n"
+    FRAME_CONSTANTS_GLSL
+    "uniform vec2 tanHalf;\n"
+    "uniform vec2 range;          // near, far of the grid\n"
+    "uniform float jitter, historyWeight, density;\n"
+    "uniform mat4 prevViewProj;\n"
+    "uniform vec3 ambient;\n"
+    "uniform vec3 spotPos, spotDir, spotColor;\n"
+    "uniform float spotCos, spotExponent;\n"
+    "const float kPi = 3.14159265;\n"
+    "float sliceDepth(float s) { return range.x * pow(range.y / range.x, s / gridSize.z); }\n"
+    "// Henyey-Greenstein, scaled so an isotropic medium gives 1\n"
+    "float phase(float c) { const float g = 0.35; float k = 1.0 + g * g - 2.0 * g * c; return (1.0 - g * g) / (k * sqrt(k)); }\n"
+    "float atten(float d, vec3 k) { return 1.0 / (k.x + k.y * d + k.z * d * d); }\n"
+    "void main() {\n"
+    "    ivec3 id = ivec3(gl_GlobalInvocationID);\n"
+    "    if (any(greaterThanEqual(id, ivec3(gridSize)))) return;\n"
+    "    vec2 ndc = (vec2(id.xy) + 0.5) / gridSize.xy * 2.0 - 1.0;\n"
+    "    vec3 ray = fwd.xyz + ndc.x * tanHalf.x * right.xyz + ndc.y * tanHalf.y * up.xyz;\n"
+    "    vec3 dir = normalize(ray);\n"
+    "    vec3 p = eye.xyz + ray * sliceDepth(float(id.z) + jitter);\n"
+    "    // thicker near the floor, nothing outside the room\n"
+    "    float sigma = density * (0.5 + 0.5 * exp(-0.7 * max(p.y, 0.0)));\n"
+    "    if (abs(p.x) > 4.0 || abs(p.z) > 4.0 || p.y < 0.0 || p.y > 3.0) sigma = 0.0;\n"
+    "    vec3 L = ambient;\n"
+    "    vec3 d = bulbPos.xyz - p; float r = length(d); vec3 l = d / r;\n"
+    "    L += bulbColor.rgb * atten(r, vec3(1.0, 0.06, 0.025)) * phase(dot(-l, -dir));\n"
+    "    d = spotPos - p; r = length(d); l = d / r;\n"
+    "    float c = dot(-l, spotDir);\n"
+    "    if (c > spotCos) L += spotColor * pow(c, spotExponent) * atten(r, vec3(1.0, 0.04, 0.02)) * phase(dot(-l, -dir));\n"
+    "    vec4 v = vec4(sigma * 0.9 * L, sigma);\n"
+    "    if (historyWeight > 0.0) {\n"
+    "        vec4 clip = prevViewProj * vec4(p, 1.0);\n"
+    "        if (clip.w > range.x) {\n"
+    "            vec3 uvw = vec3(clip.xy / clip.w * 0.5 + 0.5, log(clip.w / range.x) / log(range.y / range.x));\n"
+    "            if (all(greaterThanEqual(uvw, vec3(0.0))) && all(lessThanEqual(uvw, vec3(1.0))))\n"
+    "                v = mix(v, texture(history, uvw), historyWeight);\n"
+    "        }\n"
+    "    }\n"
+    "    imageStore(scatterOut, id, v);\n"
+    "}\n";
+
+// front-to-back: rgb = light scattered towards the eye up to the end of the
+// slice, a = transmittance to there
+const char* kFogIntegrateCS =
+    "#version 430\n"
+    "layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;\n"
+    "layout(rgba16f, binding = 0) uniform readonly image3D scatterIn;\n"
+    "layout(rgba16f, binding = 1) uniform writeonly image3D integrated;\n"
+    "uniform vec3 gridSize;\n"
+    "uniform vec2 tanHalf;\n"
+    "uniform vec2 range;\n"
+    "float sliceDepth(float s) { return range.x * pow(range.y / range.x, s / gridSize.z); }\n"
+    "void main() {\n"
+    "    ivec2 id = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    if (any(greaterThanEqual(id, ivec2(gridSize.xy)))) return;\n"
+    "    vec2 ndc = (vec2(id) + 0.5) / gridSize.xy * 2.0 - 1.0;\n"
+    "    float rayScale = length(vec3(ndc * tanHalf, 1.0));   // ray length per unit of view depth\n"
+    "    vec3 acc = vec3(0.0);\n"
+    "    float T = 1.0;\n"
+    "    for (int z = 0; z < int(gridSize.z); ++z) {\n"
+    "        vec4 s = imageLoad(scatterIn, ivec3(id, z));\n"
+    "        float dz = (sliceDepth(float(z + 1)) - sliceDepth(float(z))) * rayScale;\n"
+    "        float ext = max(s.a, 1e-5);\n"
+    "        float Ts = exp(-ext * dz);\n"
+    "        acc += T * (s.rgb - s.rgb * Ts) / ext;\n"
+    "        T *= Ts;\n"
+    "        imageStore(integrated, ivec3(id, z), vec4(acc, T));\n"
+    "    }\n"
+    "}\n";
+
+static GLuint createFogVolume() {
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_3D, tex);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, kFogGrid[0], kFogGrid[1], kFogGrid[2]);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    return tex;
+}
+
+void volfogInit(int offscreen) {
+    if (!offscreen || !(GLEW_VERSION_4_3 || GLEW_ARB_compute_shader) || !g_stream.buf) {
+        printf("Volumetric fog: unavailable (using GL_EXP2 fog)\n");
+        return;
+    }
+    g_fogInjectProg = buildComputeProgram(kFogInjectCS, "fog-inject");
+    g_fogIntegrateProg = buildComputeProgram(kFogIntegrateCS, "fog-integrate");
+    if (!g_fogInjectProg || !g_fogIntegrateProg) return;
+    g_fogScatter[0] = createFogVolume();
+    g_fogScatter[1] = createFogVolume();
+    g_fogIntegrated = createFogVolume();
+    g_volfogSupported = 1;
+}
+
+int volfogActive() {
+    return g_volfog_on && g_volfogSupported && use_perspective;
+}
+
+// inject + integrate for the current camera (after the scene was drawn, so
+// the bulb position and camera basis are this frame's)
+void volfogUpdate() {
+    DRAW_SCOPE();
+    gpuTimerBegin(g_gpuFog);
+    float aspect = (win_height == 0) ? 1.0f : (float)win_width / (float)win_height;
+    float tanY = tanf(fovy * 0.5f * DEG2RAD), tanX = tanY * aspect;
+    float range[2] = { z_near, fminf(z_far, g_volfogFar) };
+    int prev = g_fogCurrent, cur = 1 - g_fogCurrent;
+    int temporal = g_volfogTemporal && g_fogHistoryValid;
+    // Halton (base 2) jitter of the sample depth; without history the
+    // slice centre is used so the result does not depend on the frame count
+    float jitter = 0.5f;
+    if (temporal) {
+        jitter = 0.0f;
+        for (unsigned i = g_frameIndex % VOLFOG_JITTER_FRAMES + 1, f = 2; i; i /= 2, f *= 2) jitter += (float)(i % 2) / f;
+    }
+    GLuint prog = g_fogInjectProg;
+    glUseProgram(prog);
+    glBindImageTexture(0, g_fogScatter[cur], 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, g_fogScatter[prev]);
+    glUniform1i(glGetUniformLocation(prog, "history"), 0);
+    glUniform3f(glGetUniformLocation(prog, "gridSize"), (float)kFogGrid[0], (float)kFogGrid[1], (float)kFogGrid[2]);
+    glUniform2f(glGetUniformLocation(prog, "tanHalf"), tanX, tanY);
+    glUniform2f(glGetUniformLocation(prog, "range"), range[0], range[1]);
+    glUniform1f(glGetUniformLocation(prog, "jitter"), jitter);
+    glUniform1f(glGetUniformLocation(prog, "historyWeight"), temporal ? 0.9f : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "density"), g_volfogDensity);
+    glUniformMatrix4fv(glGetUniformLocation(prog, "prevViewProj"), 1, GL_FALSE, g_fogPrevViewProj);
+    glUniform3f(glGetUniformLocation(prog, "ambient"), 0.02f, 0.03f, 0.05f);
+    glUniform3f(glGetUniformLocation(prog, "spotPos"), kSpotPos[0], kSpotPos[1], kSpotPos[2]);
+    float dl = sqrtf(kSpotDir[0] * kSpotDir[0] + kSpotDir[1] * kSpotDir[1] + kSpotDir[2] * kSpotDir[2]);
+    glUniform3f(glGetUniformLocation(prog, "spotDir"), kSpotDir[0] / dl, kSpotDir[1] / dl, kSpotDir[2] / dl);
+    glUniform3f(glGetUniformLocation(prog, "spotColor"), kSpotDiffuse[0] * 3.0f, kSpotDiffuse[1] * 3.0f, kSpotDiffuse[2] * 3.0f);
+    glUniform1f(glGetUniformLocation(prog, "spotCos"), cosf(kSpotCutoffDeg * DEG2RAD));
+    glUniform1f(glGetUniformLocation(prog, "spotExponent"), kSpotExponent);
+    glDispatchCompute((kFogGrid[0] + 7) / 8, (kFogGrid[1] + 7) / 8, kFogGrid[2]);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    prog = g_fogIntegrateProg;
+    glUseProgram(prog);
+    glBindImageTexture(0, g_fogScatter[cur], 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA16F);
+    glBindImageTexture(1, g_fogIntegrated, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glUniform3f(glGetUniformLocation(prog, "gridSize"), (float)kFogGrid[0], (float)kFogGrid[1], (float)kFogGrid[2]);
+    glUniform2f(glGetUniformLocation(prog, "tanHalf"), tanX, tanY);
+    glUniform2f(glGetUniformLocation(prog, "range"), range[0], range[1]);
+    glDispatchCompute((kFogGrid[0] + 7) / 8, (kFogGrid[1] + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glUseProgram(0);
+    gpuTimerEnd(g_gpuFog);
+
+    memcpy(g_fogPrevViewProj, g_viewProj, sizeof(g_fogPrevViewProj));
+    g_fogCurrent = cur;
+    g_fogHistoryValid = 1;
+}
+
+// ---------------- Post-processing (B: chain, N: quality, F5-F7: effects) ----------------
+// Bloom for the emissive bulb plus vignette and film grain. The bright-pass
+// and the separable blurs run at half and quarter resolution; only the
+// composite (which also does the dynamic-resolution upscale) touches every
+// window pixel.
+enum { POST_LOW, POST_MEDIUM, POST_HIGH, POST_PRESETS };
+const char* kPostPresetName[POST_PRESETS] = { "low", "medium", "high" };
+int g_post_on = 0;
+int g_postPreset = POST_LOW;
+int g_postBloom = 1, g_postVignette = 1, g_postGrain = 1;
+float g_bloomThreshold = 0.8f, g_bloomStrength = 0.9f;
+int g_postSupported = 0;
+GLuint g_brightProg = 0, g_blurProg = 0, g_compositeProg = 0;
+RenderTarget g_sceneRT, g_halfRT[2], g_quarterRT[2];
+int g_sceneW = 0, g_sceneH = 0;     // resolution the scene was rendered at this frame
+GpuTimer g_gpuBright, g_gpuBlurHalf, g_gpuBlurQuarter, g_gpuComposite;
+
+const char* kBrightFS =
+    "#version 120\n"
+    "uniform sampler2D src;\n"
+    "uniform vec2 srcScale;   // uv of the rendered sub-rectangle's far corner\n"
+    "uniform vec2 srcTexel;\n"
+    "uniform float threshold; // < 0: plain downsample\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    vec2 p = uv * srcScale;\n"
+    "    vec3 c = 0.25 * (texture2D(src, p + srcTexel * vec2(-1.0, -1.0)).rgb + texture2D(src, p + srcTexel * vec2(1.0, -1.0)).rgb\n"
+    "                   + texture2D(src, p + srcTexel * vec2(-1.0, 1.0)).rgb + texture2D(src, p + srcTexel * vec2(1.0, 1.0)).rgb);\n"
+    "    if (threshold >= 0.0) {\n"
+    "        float l = max(c.r, max(c.g, c.b));\n"
+    "        float knee = 0.2;\n"
+    "        float soft = clamp(l - threshold + knee, 0.0, 2.0 * knee);\n"
+    "        soft = soft * soft / (4.0 * knee + 1e-4);\n"
+    "        c *= max(soft, l - threshold) / max(l, 1e-4);\n"
+    "    }\n"
+    "    gl_FragColor = vec4(c, 1.0);\n"
+    "}\n";
+
+const char* kBlurFS =
+    "#version 120\n"
+    "uniform sampler2D src;\n"
+    "uniform vec2 srcScale;\n"
+    "uniform vec2 srcTexel;\n"
+    "uniform vec2 dir;        // one texel along the blur axis, in uv\n"
+    "uniform int wide;        // 9-tap instead of 5-tap Gaussian (both via bilinear taps)\n"
+    "varying vec2 uv;\n"
+    "vec3 tap(vec2 p) { return texture2D(src, clamp(p, srcTexel * 0.5, srcScale - srcTexel * 0.5)).rgb; }\n"
+    "void main() {\n"
+    "    vec2 p = uv * srcScale;\n"
+    "    vec3 c;\n"
+    "    if (wide == 1)\n"
+    "        c = tap(p) * 0.2270 + (tap(p + dir * 1.3846) + tap(p - dir * 1.3846)) * 0.3162\n"
+    "          + (tap(p + dir * 3.2308) + tap(p - dir * 3.2308)) * 0.0703;\n"
+    "    else\n"
+    "        c = tap(p) * 0.2941 + (tap(p + dir * 1.3333) + tap(p - dir * 1.3333)) * 0.3529;\n"
+    "    gl_FragColor = vec4(c, 1.0);\n"
+    "}\n";
+
+const char* kCompositeFS =
+    "#version 120\n"
+    "uniform sampler2D scene, bloomHalf, bloomQuarter;\n"
+    "uniform vec2 texSize;    // scene texture size in texels\n"
+    "uniform vec2 srcSize;    // rendered sub-rectangle in texels\n"
+    "uniform vec2 halfScale, quarterScale;\n"
+    "uniform int bicubic;\n"
+    "uniform float halfWeight, quarterWeight, vignette, grain, time;\n"
+    "uniform int fogOn;\n"
+    "uniform sampler3D fogVolume;\n"
+    "uniform sampler2D sceneDepth;\n"
+    "uniform vec2 depthRange;  // projection near/far\n"
+    "uniform vec2 fogRange;    // froxel grid near/far\n"
+    "uniform float fogSlices;\n"
+    "varying vec2 uv;\n"
+    "vec3 tap(vec2 p) { return texture2D(scene, clamp(p, vec2(0.5), srcSize - 0.5) / texSize).rgb; }\n"
+    "vec3 sceneColor() {\n"
+    "    if (bicubic == 0) return texture2D(scene, uv * srcSize / texSize).rgb;\n"
+    "    // Catmull-Rom in 9 bilinear taps (weights folded into the tap positions)\n"
+    "    vec2 p = uv * srcSize;\n"
+    "    vec2 c = floor(p - 0.5) + 0.5;\n"
+    "    vec2 f = p - c;\n"
+    "    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));\n"
+    "    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);\n"
+    "    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));\n"
+    "    vec2 w3 = f * f * (-0.5 + 0.5 * f);\n"
+    "    vec2 w12 = w1 + w2;\n"
+    "    vec2 p0 = c - 1.0, p3 = c + 2.0, p12 = c + w2 / w12;\n"
+    "    return (tap(vec2(p0.x, p0.y)) * w0.x + tap(vec2(p12.x, p0.y)) * w12.x + tap(vec2(p3.x, p0.y)) * w3.x) * w0.y\n"
+    "         + (tap(vec2(p0.x, p12.y)) * w0.x + tap(vec2(p12.x, p12.y)) * w12.x + tap(vec2(p3.x, p12.y)) * w3.x) * w12.y\n"
+    "         + (tap(vec2(p0.x, p3.y)) * w0.x + tap(vec2(p12.x, p3.y)) * w12.x + tap(vec2(p3.x, p3.y)) * w3.x) * w3.y;\n"
+    "}\n"
+    "void main() {\n"
+    "    vec3 c = max(sceneColor(), 0.0);\n"
+    "    if (fogOn == 1) {\n"
+    "        float d = texture2D(sceneDepth, uv * srcSize / texSize).r;\n"
+    "        float z = depthRange.x * depthRange.y / (depthRange.y - d * (depthRange.y - depthRange.x));\n"
+    "        float s = log(max(z, fogRange.x) / fogRange.x) / log(fogRange.y / fogRange.x) * fogSlices;\n"
+    "        vec4 f = texture3D(fogVolume, vec3(uv, (s - 0.5) / fogSlices));\n"
+    "        c = c * f.a + f.rgb;\n"
+    "    }\n"
+    "    if (halfWeight > 0.0) c += halfWeight * texture2D(bloomHalf, uv * halfScale).rgb;\n"
+    "    if (quarterWeight > 0.0) c += quarterWeight * texture2D(bloomQuarter, uv * quarterScale).rgb;\n"
+    "    if (vignette > 0.0) { vec2 d = uv - 0.5; c *= 1.0 - vignette * smoothstep(0.1, 0.5, dot(d, d)); }\n"
+    "    if (grain > 0.0) {\n"
+    "        float n = fract(sin(dot(gl_FragCoord.xy + fract(time * 7.31) * 613.0, vec2(12.9898, 78.233))) * 43758.5453);\n"
+    "        c += grain * (n - 0.5);\n"
+    "    }\n"
+    "    gl_FragColor = vec4(c, 1.0);\n"
+    "}\n";
+
+void postInit() {
+    g_postSupported = (GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) && GLEW_VERSION_2_0;
+    if (g_postSupported) {
+        g_brightProg = buildProgram(kFullscreenVS, kBrightFS, "bright-pass");
+        g_blurProg = buildProgram(kFullscreenVS, kBlurFS, "blur");
+        g_compositeProg = buildProgram(kFullscreenVS, kCompositeFS, "composite");
+    }
+    if (!g_brightProg || !g_blurProg || !g_compositeProg) {
+        g_postSupported = 0;
+        printf("Post-processing / dynamic resolution: unavailable\n");
+    }
+}
+
+// bind the offscreen scene target (returns 0 to render straight to the window)
+int sceneBegin() {
+    g_sceneW = win_width; g_sceneH = win_height;
+    if (!g_postSupported || !(g_dynres_on || g_post_on || g_aaMode != AA_NONE || volfogActive())) return 0;
+    if (g_sceneRT.w != win_width || g_sceneRT.h != win_height) {
+        int ok = createRenderTarget(g_sceneRT, win_width, win_height, 1);
+        for (int i = 0; i < 2 && ok; ++i) {
+            ok = createRenderTarget(g_halfRT[i], (win_width + 1) / 2, (win_height + 1) / 2, 0) &&
+                createRenderTarget(g_quarterRT[i], (win_width + 3) / 4, (win_height + 3) / 4, 0);
+        }
+        if (!ok) { g_postSupported = 0; return 0; }
+    }
+    if (g_dynres_on) {
+        g_sceneW = (int)(win_width * g_dynres.scale + 0.5f);
+        g_sceneH = (int)(win_height * g_dynres.scale + 0.5f);
+        if (g_sceneW < 1) g_sceneW = 1;
+        if (g_sceneH < 1) g_sceneH = 1;
+    }
+    if (!aaBegin(g_sceneRT.w, g_sceneRT.h)) glBindFramebuffer(GL_FRAMEBUFFER, g_sceneRT.fbo);
+    glViewport(0, 0, g_sceneW, g_sceneH);
+    return 1;
+}
+
+// one full-screen pass from src (sub-rectangle srcW x srcH) into dst (w x h)
+static void postPass(GLuint prog, const RenderTarget& src, int srcW, int srcH, const RenderTarget& dst, int w, int h) {
+    glBindFramebuffer(GL_FRAMEBUFFER, dst.fbo);
+    glViewport(0, 0, w, h);
+    glUseProgram(prog);
+    glBindTexture(GL_TEXTURE_2D, src.color);
+    glUniform1i(glGetUniformLocation(prog, "src"), 0);
+    glUniform2f(glGetUniformLocation(prog, "srcScale"), (float)srcW / src.w, (float)srcH / src.h);
+    glUniform2f(glGetUniformLocation(prog, "srcTexel"), 1.0f / src.w, 1.0f / src.h);
+    drawFullscreenQuad();
+}
+
+static void blurPair(RenderTarget* rt, int w, int h, int wide) {
+    glUseProgram(g_blurProg);
+    glUniform1i(glGetUniformLocation(g_blurProg, "wide"), wide);
+    glUniform2f(glGetUniformLocation(g_blurProg, "dir"), 1.0f / rt[0].w, 0.0f);
+    postPass(g_blurProg, rt[0], w, h, rt[1], w, h);
+    glUniform2f(glGetUniformLocation(g_blurProg, "dir"), 0.0f, 1.0f / rt[1].h);
+    postPass(g_blurProg, rt[1], w, h, rt[0], w, h);
+}
+
+// bloom chain + composite/upscale of the scene target into dstFbo
+void sceneResolve(GLuint dstFbo, int dstW, int dstH) {
+    DRAW_SCOPE();
+    glDisable(GL_DEPTH_TEST); glDisable(GL_LIGHTING); glDisable(GL_FOG);
+    glActiveTexture(GL_TEXTURE0);
+    const RenderTarget& src = *aaResolve(g_sceneRT, g_sceneW, g_sceneH);
+    int post = g_post_on && !g_overdrawView;     // the overdraw view goes out as counted
+    int fog = volfogActive() && !g_overdrawView;
+    if (fog) volfogUpdate();
+    else g_fogHistoryValid = 0;
+    int hw = (g_sceneW + 1) / 2, hh = (g_sceneH + 1) / 2, qw = (g_sceneW + 3) / 4, qh = (g_sceneH + 3) / 4;
+    int bloom = post && g_postBloom;
+    int useHalf = bloom && g_postPreset != POST_LOW;
+    if (bloom) {
+        glUseProgram(g_brightProg);
+        glUniform1f(glGetUniformLocation(g_brightProg, "threshold"), g_bloomThreshold);
+        gpuTimerBegin(g_gpuBright);
+        if (useHalf) postPass(g_brightProg, src, g_sceneW, g_sceneH, g_halfRT[0], hw, hh);
+        else postPass(g_brightProg, src, g_sceneW, g_sceneH, g_quarterRT[0], qw, qh);
+        gpuTimerEnd(g_gpuBright);
+        if (useHalf) {
+            gpuTimerBegin(g_gpuBlurHalf);
+            blurPair(g_halfRT, hw, hh, g_postPreset == POST_HIGH);
+            gpuTimerEnd(g_gpuBlurHalf);
+            glUseProgram(g_brightProg);
+            glUniform1f(glGetUniformLocation(g_brightProg, "threshold"), -1.0f);
+            postPass(g_brightProg, g_halfRT[0], hw, hh, g_quarterRT[0], qw, qh);
+        }
+        gpuTimerBegin(g_gpuBlurQuarter);
+        blurPair(g_quarterRT, qw, qh, g_postPreset == POST_HIGH);
+        gpuTimerEnd(g_gpuBlurQuarter);
+    }
+
+    gpuTimerBegin(g_gpuComposite);
+    GLuint prog = g_compositeProg;
+    glBindFramebuffer(GL_FRAMEBUFFER, dstFbo);
+    glViewport(0, 0, dstW, dstH);
+    glUseProgram(prog);
+    glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, g_halfRT[0].color);
+    glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_2D, g_quarterRT[0].color);
+    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, src.color);
+    glUniform1i(glGetUniformLocation(prog, "scene"), 0);
+    glUniform1i(glGetUniformLocation(prog, "bloomHalf"), 1);
+    glUniform1i(glGetUniformLocation(prog, "bloomQuarter"), 2);
+    glUniform2f(glGetUniformLocation(prog, "texSize"), (float)src.w, (float)src.h);
+    glUniform2f(glGetUniformLocation(prog, "srcSize"), (float)g_sceneW, (float)g_sceneH);
+    glUniform2f(glGetUniformLocation(prog, "halfScale"), (float)hw / g_halfRT[0].w, (float)hh / g_halfRT[0].h);
+    glUniform2f(glGetUniformLocation(prog, "quarterScale"), (float)qw / g_quarterRT[0].w, (float)qh / g_quarterRT[0].h);
+    glUniform1i(glGetUniformLocation(prog, "bicubic"), g_sceneW != dstW || g_sceneH != dstH);
+    glUniform1f(glGetUniformLocation(prog, "halfWeight"), useHalf ? g_bloomStrength * 0.5f : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "quarterWeight"), bloom ? g_bloomStrength * (useHalf ? 0.5f : 1.0f) : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "vignette"), post && g_postVignette ? 0.55f : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "grain"), post && g_postGrain ? 0.05f : 0.0f);
+    glUniform1f(glGetUniformLocation(prog, "time"), timeSec);
+    glUniform1i(glGetUniformLocation(prog, "fogOn"), fog);
+    if (fog) {
+        glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_3D, g_fogIntegrated);
+        glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D, g_sceneRT.depth);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(prog, "fogVolume"), 3);
+        glUniform1i(glGetUniformLocation(prog, "sceneDepth"), 4);
+        glUniform2f(glGetUniformLocation(prog, "depthRange"), z_near, z_far);
+        glUniform2f(glGetUniformLocation(prog, "fogRange"), z_near, fminf(z_far, g_volfogFar));
+        glUniform1f(glGetUniformLocation(prog, "fogSlices"), (float)kFogGrid[2]);
+    }
+    drawFullscreenQuad();
+    gpuTimerEnd(g_gpuComposite);
+
+    glUseProgram(0);
+    glActiveTexture(GL_TEXTURE4); glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE3); glBindTexture(GL_TEXTURE_3D, 0);
+    glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, 0);
+    glEnable(GL_DEPTH_TEST); glEnable(GL_LIGHTING); glEnable(GL_FOG);
+}
+
+// ---------------- Texture streaming & hot reload ----------------
+// Material textures are resident only from some mip level down. This covers
+// the per-material textures the immediate path binds. The batch and
+// GPU-driven paths sample the fixed-size material array, which counts
+// against the same budget. Startup loads the levels from the first one no
+// larger than TEX_START_SIZE. Each frame, texStreamUpdate() derives the
+// level each material needs from the on-screen size of the surfaces that
+// use it, then fits those levels into the memory budget. When residency
+// should change, it asks the loader thread for a new chain. Finer levels
+// are requested at once; coarser ones after they have been enough for
+// TEX_DROP_FRAMES frames, or at once when the budget forces them. A coarser
+// chain is copied out of the resident one on the GPU when GL 4.3 /
+// ARB_copy_image is there, without the loader.
+//
+// The loader reads the chain from the mip cache (TEX_MIP_CACHE, levels 1
+// and below of each file) or decodes the file, building the chain from the
+// requested level down and refreshing the cache, plus the array layer on a
+// reload. The main thread uploads the chain into a new texture object, then
+// the layer's chain into a scratch texture, HOT_UPLOAD_BYTES per frame. The
+// old texture stays bound until the last level of both is in; then the
+// layer is copied into the material array on the GPU in one step (without
+// copy support the layer is uploaded whole in the swap frame).
+//
+// A watcher thread sees edits to textures/ and room.cfg (inotify on Linux,
+// mtime polling elsewhere). An edited texture is reloaded at its current
+// residency. A file that fails to decode, usually because it is still being
+// written, keeps the old texture until the next change.
+#define HOT_UPLOAD_BYTES (4 << 20)
+#define TEX_START_SIZE 256
+#define TEX_DROP_FRAMES 120
+#define TEX_MIP_CACHE "textures/.mips"
+const char* kSceneConfig = "room.cfg";
+GLuint* const kMatTex[MAT_LAYERS] = { &texFloor, &texWall, &texCeil, &texWood, &texPainting, &texEarth };
+const char kMatShort[MAT_LAYERS][3] = { "Fl", "Wa", "Ce", "Wo", "Pa", "Ea" };
+struct TexStream { int w, h, levels, resident, want, target, pending, coarserFrames; };  // levels == 0: no file
+TexStream g_texStream[MAT_LAYERS];
+float g_texBudgetMB = 128.0f;
+int g_texStreamOn = 1;      // 0: residency is set once from the budget (offline renders)
+
+struct HotLevel { int w, h; std::vector<unsigned char> px; };
+struct HotImage { int mat, base, w, h; std::vector<HotLevel> tex, layer; };  // tex[0] is level `base` of a w x h image
+struct HotUpload { HotImage img; GLuint id, layerId; int level, row, frames; float maxMs; };   // level counts tex, then layer
+struct TexRequest { int mat, base, reload; };   // base < 0: the startup level
+struct HotReload {
+    std::thread watcher, loader;
+    std::atomic<bool> quit{ false };
+    std::atomic<int> cfgChanged{ 0 }, filesChanged{ 0 };  // bit per material
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::vector<TexRequest> requests;   // at most one per material
+    std::vector<HotImage> ready;        // decoded (tex empty: failed), waiting for the main thread
+    std::deque<HotUpload> uploads;      // main thread only
+    int reloads = 0, streamed = 0;
+};
+HotReload g_hot;
+
+// "name value" per line, '#' starts a comment; unknown names are reported
+struct ConfigVar { const char* name; float* value; };
+const ConfigVar kConfigVars[] = {
+    { "fov", &fovy }, { "look_speed", &lookSpeed }, { "max_speed", &maxSpeed },
+    { "mouse_sens", &mouseSensitivity }, { "mouse_smooth", &mouseSmoothing }, { "fog_density", &g_volfogDensity },
+    { "tex_budget_mb", &g_texBudgetMB },
+};
+
+int loadSceneConfig(const char* file) {
+    FILE* f = fopen(file, "r");
+    if (!f) return 0;
+    char line[256], name[64];
+    float v;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%63s %f", name, &v) != 2) continue;
+        int known = 0;
+        for (const ConfigVar& c : kConfigVars)
+            if (!strcmp(c.name, name)) { *c.value = v; known = 1; }
+        if (!known) printf("%s: unknown setting '%s'\n", file, name);
+    }
+    fclose(f);
+    fovy = clampf(fovy, 20.0f, 90.0f);
+    if (mouseSmoothing < 0.0f) mouseSmoothing = 0.0f;
+    return 1;
+}
+
+// the 2x2 box-filtered level below a w x h RGBA image
+static HotLevel hotHalve(const unsigned char* px, int w, int h) {
+    HotLevel d;
+    d.w = w > 1 ? w / 2 : 1; d.h = h > 1 ? h / 2 : 1;
+    d.px.resize((size_t)d.w * d.h * 4);
+    for (int y = 0; y < d.h; ++y)
+        for (int x = 0; x < d.w; ++x) {
+            int x0 = 2 * x < w ? 2 * x : w - 1, x1 = 2 * x + 1 < w ? 2 * x + 1 : x0;
+            int y0 = 2 * y < h ? 2 * y : h - 1, y1 = 2 * y + 1 < h ? 2 * y + 1 : y0;
+            for (int c = 0; c < 4; ++c)
+                d.px[((size_t)y * d.w + x) * 4 + c] = (unsigned char)((px[((size_t)y0 * w + x0) * 4 + c] +
+                    px[((size_t)y0 * w + x1) * 4 + c] + px[((size_t)y1 * w + x0) * 4 + c] +
+                    px[((size_t)y1 * w + x1) * 4 + c] + 2) / 4);
+        }
+    return d;
+}
+
+// appends 2x2 box-filtered levels down to 1x1
+static void hotBuildMips(std::vector<HotLevel>& lv) {
+    while (lv.back().w > 1 || lv.back().h > 1) lv.push_back(hotHalve(lv.back().px.data(), lv.back().w, lv.back().h));
+}
+
+static int mipLevels(int w, int h) {
+    int n = 1;
+    for (; w > 1 || h > 1; ++n) { w = w > 1 ? w / 2 : 1; h = h > 1 ? h / 2 : 1; }
+    return n;
+}
+
+static size_t mipChainBytes(int w, int h, int base) {
+    size_t bytes = 0;
+    for (int l = base, n = mipLevels(w, h); l < n; ++l) bytes += (size_t)std::max(1, w >> l) * std::max(1, h >> l) * 4;
+    return bytes;
+}
+
+size_t texResidentBytes() {
+    size_t bytes = 0;
+    for (const TexStream& s : g_texStream) bytes += s.levels ? mipChainBytes(s.w, s.h, s.resident) : 0;
+    return bytes;
+}
+
+static size_t texArrayBytes() { return g_matArray ? mipChainBytes(g_matSize, g_matSize, 0) * MAT_LAYERS : 0; }
+
+// what the streamed textures may use: the budget less the fixed material array
+static size_t texStreamBudget() {
+    size_t budget = (size_t)(std::max(g_texBudgetMB, 1.0f) * 1048576.0f), array = texArrayBytes();
+    return budget > array + 1048576 ? budget - array : 1048576;
+}
+
+static int texStartLevel(int w, int h) {
+    int l = 0;
+    while ((w >> l) > TEX_START_SIZE || (h >> l) > TEX_START_SIZE) ++l;
+    return l;
+}
+
+// Mip cache: levels 1 and below of each decoded texture, raw RGBA after a
+// header that stamps the source file. Requests that don't need level 0 read
+// their chain from here instead of decoding the image again.
+struct TexCacheHeader { int64_t mtime, size; char magic[8]; int32_t w, h; };
+const char kTexCacheMagic[8] = { 'R', 'O', 'O', 'M', 'M', 'I', 'P', '1' };
+
+static std::string texCachePath(int mat) {
+    const char* name = strrchr(kMatFile[mat], '/');
+    return std::string(TEX_MIP_CACHE "/") + (name ? name + 1 : kMatFile[mat]) + ".mips";
+}
+
+// returns 1 if the cache matches the source; img.tex is filled when it
+// also holds the requested level
+static int texCacheRead(const TexRequest& r, const struct stat& st, HotImage& img) {
+    FILE* f = fopen(texCachePath(r.mat).c_str(), "rb");
+    if (!f) return 0;
+    TexCacheHeader hd;
+    int valid = fread(&hd, sizeof(hd), 1, f) == 1 && !memcmp(hd.magic, kTexCacheMagic, sizeof(hd.magic)) &&
+        hd.mtime == (int64_t)st.st_mtime && hd.size == (int64_t)st.st_size && hd.w > 0 && hd.h > 0 && hd.w <= 65536 && hd.h <= 65536;
+    int base = !valid ? 0 : r.base < 0 ? texStartLevel(hd.w, hd.h) : std::min(r.base, mipLevels(hd.w, hd.h) - 1);
+    if (base > 0) {
+        long skip = 0;
+        for (int l = 1; l < base; ++l) skip += (long)std::max(1, hd.w >> l) * std::max(1, hd.h >> l) * 4;
+        int ok = fseek(f, skip, SEEK_CUR) == 0;
+        for (int l = base, n = mipLevels(hd.w, hd.h); ok && l < n; ++l) {
+            HotLevel lv{ std::max(1, hd.w >> l), std::max(1, hd.h >> l), {} };
+            lv.px.resize((size_t)lv.w * lv.h * 4);
+            ok = fread(lv.px.data(), lv.px.size(), 1, f) == 1;
+            img.tex.push_back(std::move(lv));
+        }
+        if (ok) { img.w = hd.w; img.h = hd.h; img.base = base; }
+        else { img.tex.clear(); valid = 0; }    // truncated: rewrite it
+    }
+    fclose(f);
+    return valid;
+}
+
+// written to a temporary name and renamed over the old cache when complete
+static FILE* texCacheCreate(int mat, const struct stat& st, int w, int h) {
+    FILE* f = fopen((texCachePath(mat) + ".tmp").c_str(), "wb");
+    if (!f) return NULL;
+    TexCacheHeader hd;
+    hd.mtime = (int64_t)st.st_mtime; hd.size = (int64_t)st.st_size;
+    memcpy(hd.magic, kTexCacheMagic, sizeof(hd.magic));
+    hd.w = w; hd.h = h;
+    fwrite(&hd, sizeof(hd), 1, f);
+    return f;
+}
+
+static void texCacheFinish(FILE* f, int mat) {
+    std::string path = texCachePath(mat), tmp = path + ".tmp";
+    int ok = !ferror(f);
+    if (fclose(f)) ok = 0;
+#ifdef _WIN32
+    if (ok) remove(path.c_str());   // rename doesn't replace there
+#endif
+    if (!ok || rename(tmp.c_str(), path.c_str())) remove(tmp.c_str());
+}
+
+// the chain from the requested level down: from the mip cache when it has
+// it, otherwise decoded. Levels above the base are halved through and
+// dropped, so SOIL's buffer is the only full-size copy unless level 0 is
+// wanted.
+static int texDecode(const TexRequest& r, HotImage& img) {
+    int w, h, ch;
+    img.mat = r.mat; img.base = r.base;
+    struct stat st;
+    int stamped = !stat(kMatFile[r.mat], &st), cached = 0;
+    if (stamped && !r.reload) {
+        cached = texCacheRead(r, st, img);
+        if (!img.tex.empty()) return 1;
+    }
+    unsigned char* px = SOIL_load_image(kMatFile[r.mat], &w, &h, &ch, SOIL_LOAD_RGBA);
+    if (!px) {
+        if (r.reload) printf("Hot reload: '%s' did not decode (%s); keeping the old texture\n", kMatFile[r.mat], SOIL_last_result());
+        else printf("SOIL2: failed to load '%s' : %s\n", kMatFile[r.mat], SOIL_last_result());
+        return 0;
+    }
+    flipRows(px, w, h);     // SOIL_FLAG_INVERT_Y
+    img.w = w; img.h = h;
+    img.base = r.base < 0 ? texStartLevel(w, h) : std::min(r.base, mipLevels(w, h) - 1);
+    if (r.reload && g_matArray) {
+        img.layer.push_back(HotLevel{ g_matSize, g_matSize, std::vector<unsigned char>((size_t)g_matSize * g_matSize * 4) });
+        resampleRGBA(px, w, h, img.layer[0].px.data(), g_matSize, g_matSize);
+        hotBuildMips(img.layer);
+    }
+    const unsigned char* src = px;
+    if (img.base == 0) {
+        img.tex.push_back(HotLevel{ w, h, std::vector<unsigned char>(px, px + (size_t)w * h * 4) });
+        SOIL_free_image_data(px);
+        px = NULL;
+        src = img.tex[0].px.data();
+    }
+    FILE* cache = stamped && !cached ? texCacheCreate(r.mat, st, w, h) : NULL;
+    HotLevel above;     // the last level made, while it is above the base
+    for (int l = 1, n = mipLevels(w, h); l < n; ++l) {
+        HotLevel d = hotHalve(src, std::max(1, w >> (l - 1)), std::max(1, h >> (l - 1)));
+        if (px) { SOIL_free_image_data(px); px = NULL; }
+        if (cache) fwrite(d.px.data(), d.px.size(), 1, cache);
+        if (l >= img.base) { img.tex.push_back(std::move(d)); src = img.tex.back().px.data(); }
+        else { above = std::move(d); src = above.px.data(); }
+    }
+    if (px) SOIL_free_image_data(px);     // a 1x1 image
+    if (cache) texCacheFinish(cache, r.mat);
+    return 1;
+}
+
+static void texLoaderLoop() {
+    PROFILE_THREAD("tex-loader");
+    for (;;) {
+        TexRequest r;
+        {
+            std::unique_lock<std::mutex> lk(g_hot.mtx);
+            g_hot.wake.wait(lk, [] { return g_hot.quit || !g_hot.requests.empty(); });
+            if (g_hot.quit) return;
+            r = g_hot.requests.front();
+            g_hot.requests.erase(g_hot.requests.begin());
+        }
+        HotImage img;
+        texDecode(r, img);
+        std::lock_guard<std::mutex> lk(g_hot.mtx);
+        g_hot.ready.push_back(std::move(img));
+    }
+}
+
+// replaces a queued request for the same material
+static void texRequest(int mat, int base, int reload) {
+    ALLOC_CHECK_SETTLE();
+    g_texStream[mat].pending = base;
+    {
+        std::lock_guard<std::mutex> lk(g_hot.mtx);
+        auto it = std::find_if(g_hot.requests.begin(), g_hot.requests.end(), [&](const TexRequest& r) { return r.mat == mat; });
+        if (it != g_hot.requests.end()) { it->base = base; it->reload |= reload; }
+        else g_hot.requests.push_back(TexRequest{ mat, base, reload });
+    }
+    g_hot.wake.notify_one();
+}
+
+static void hotFileChanged(const char* path) {
+    for (int i = 0; i < MAT_LAYERS; ++i)
+        if (!strcmp(path, kMatFile[i])) g_hot.filesChanged |= 1 << i;
+    if (!strcmp(path, kSceneConfig)) g_hot.cfgChanged = 1;
+}
+
+static void hotWatchPolling() {
+    struct stat st;
+    const int n = MAT_LAYERS + 1;
+    double stamp[MAT_LAYERS + 1];
+    auto path = [](int i) { return i < MAT_LAYERS ? kMatFile[i] : kSceneConfig; };
+    for (int i = 0; i < n; ++i) stamp[i] = stat(path(i), &st) ? 0.0 : (double)st.st_mtime + st.st_size * 1e-12;
+    for (int tick = 0; !g_hot.quit; ++tick) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (tick % 5) continue;
+        for (int i = 0; i < n; ++i) {
+            double s = stat(path(i), &st) ? 0.0 : (double)st.st_mtime + st.st_size * 1e-12;
+            if (s != stamp[i] && s != 0.0) hotFileChanged(path(i));
+            stamp[i] = s;
+        }
+    }
+}
+
+static void hotWatch() {
+    PROFILE_THREAD("tex-watch");
+#ifdef __linux__
+    // editors either rewrite in place (close-write) or rename a temp file over it (moved-to)
+    int fd = inotify_init1(IN_NONBLOCK);
+    int wdTex = fd >= 0 ? inotify_add_watch(fd, "textures", IN_CLOSE_WRITE | IN_MOVED_TO) : -1;
+    int wdCfg = fd >= 0 ? inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) : -1;
+    if (wdTex >= 0 || wdCfg >= 0) {
+        alignas(inotify_event) char buf[4096];
+        while (!g_hot.quit) {
+            pollfd p = { fd, POLLIN, 0 };
+            if (poll(&p, 1, 200) <= 0) continue;
+            std::vector<std::string> changed;   // one decode per file per batch of events
+            ssize_t len = read(fd, buf, sizeof(buf));
+            for (char* e = buf; len > 0 && e < buf + len;) {
+                const inotify_event* ev = (const inotify_event*)e;
+                if (ev->len) {
+                    std::string path = (ev->wd == wdTex ? "textures/" : "") + std::string(ev->name);
+                    if (std::find(changed.begin(), changed.end(), path) == changed.end()) changed.push_back(path);
+                }
+                e += sizeof(inotify_event) + ev->len;
+            }
+            for (const std::string& path : changed) hotFileChanged(path.c_str());
+        }
+        close(fd);
+        return;
+    }
+    if (fd >= 0) close(fd);
+    printf("Hot reload: inotify unavailable, polling instead\n");
+#endif
+    hotWatchPolling();
+}
+
+void texLoaderStart() {
+    g_hot.loader = std::thread(texLoaderLoop);
+    g_hot.watcher = std::thread(hotWatch);
+}
+
+void texLoaderStop() {
+    if (!g_hot.loader.joinable()) return;
+    { std::lock_guard<std::mutex> lk(g_hot.mtx); g_hot.quit = true; }
+    g_hot.wake.notify_all();
+    g_hot.loader.join();
+    g_hot.watcher.join();
+}
+
+static GLuint texAllocate(const std::vector<HotLevel>& chain) {
+    GLuint id = 0;
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    if (GLEW_ARB_texture_storage) glTexStorage2D(GL_TEXTURE_2D, (GLsizei)chain.size(), GL_RGBA8, chain[0].w, chain[0].h);
+    else
+        for (int l = 0; l < (int)chain.size(); ++l)
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, chain[l].w, chain[l].h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return id;
+}
+
+// a reload's array layer: staged layers are copied over in one step on the
+// GPU; without copy support the CPU levels go up whole
+static void texLayerSwapIn(const HotImage& img, GLuint staged) {
+    for (int l = 0; l < (int)img.layer.size(); ++l) {
+        const HotLevel& lv = img.layer[l];
+        if (staged) glCopyImageSubData(staged, GL_TEXTURE_2D, l, 0, 0, 0, g_matArray, GL_TEXTURE_2D_ARRAY, l, 0, 0, img.mat, lv.w, lv.h, 1);
+        else {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, g_matArray);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, img.mat, lv.w, lv.h, 1, GL_RGBA, GL_UNSIGNED_BYTE, lv.px.data());
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+    }
+}
+
+// the upload is complete: make it the material's texture
+static void texSwapIn(const HotImage& img, GLuint id) {
+    GLuint old = *kMatTex[img.mat];
+    *kMatTex[img.mat] = id;
+    if (old) glDeleteTextures(1, &old);
+    TexStream& s = g_texStream[img.mat];
+    s.w = img.w; s.h = img.h; s.levels = mipLevels(img.w, img.h);
+    s.resident = img.base;
+    if (s.pending == img.base) s.pending = -1;
+    if (!img.layer.empty()) g_hot.reloads++;     // its array layer went up with the chain
+    else g_hot.streamed++;
+}
+
+// coarser residency: copied out of the levels already on the GPU where
+// that is supported, otherwise the loader reads them from the mip cache
+static void texDrop(int mat, int base) {
+    if (!(GLEW_VERSION_4_3 || GLEW_ARB_copy_image)) { texRequest(mat, base, 0); return; }
+    const TexStream& s = g_texStream[mat];
+    std::vector<HotLevel> chain;
+    for (int l = base; l < s.levels; ++l) chain.push_back(HotLevel{ std::max(1, s.w >> l), std::max(1, s.h >> l), {} });
+    GLuint id = texAllocate(chain);
+    for (int l = 0; l < (int)chain.size(); ++l)
+        glCopyImageSubData(*kMatTex[mat], GL_TEXTURE_2D, base - s.resident + l, 0, 0, 0, id, GL_TEXTURE_2D, l, 0, 0, 0, chain[l].w, chain[l].h, 1);
+    HotImage img;
+    img.mat = mat; img.base = base; img.w = s.w; img.h = s.h;
+    texSwapIn(img, id);
+}
+
+// decodes the requests as jobs and uploads them before returning
+static void texLoadNow(const TexRequest* req, int n) {
+    struct Batch { const TexRequest* req; HotImage img[MAT_LAYERS]; int ok[MAT_LAYERS]; } batch;
+    batch.req = req;
+    jobParallelFor(n, [](int i, void* c) { Batch* b = (Batch*)c; b->ok[i] = texDecode(b->req[i], b->img[i]); }, &batch, 1);
+    for (int i = 0; i < n; ++i) {
+        if (!batch.ok[i]) continue;
+        const HotImage& img = batch.img[i];
+        GLuint id = texAllocate(img.tex);
+        glBindTexture(GL_TEXTURE_2D, id);
+        for (int l = 0; l < (int)img.tex.size(); ++l)
+            glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, img.tex[l].w, img.tex[l].h, GL_RGBA, GL_UNSIGNED_BYTE, img.tex[l].px.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        texSwapIn(img, id);
+    }
+}
+
+// startup: every material at its startup level
+void texStreamInit() {
+    TexRequest req[MAT_LAYERS];
+    for (int i = 0; i < MAT_LAYERS; ++i) {
+        g_texStream[i] = TexStream{ 0, 0, 0, -1, 0, 0, -1, 0 };
+        req[i] = TexRequest{ i, -1, 0 };
+    }
+    makeDir(TEX_MIP_CACHE);
+    texLoadNow(req, MAT_LAYERS);
+    g_hot.streamed = 0;
+    printf("Textures: streamed by mip level, %.1f MB resident at startup, budget %.0f MB\n", texResidentBytes() / 1048576.0, g_texBudgetMB);
+}
+
+// lowers targets, largest chain first, until they fit the budget
+static void texFitBudget() {
+    size_t budget = texStreamBudget(), total = 0;
+    for (TexStream& s : g_texStream) {
+        s.target = s.want;
+        if (s.levels) total += mipChainBytes(s.w, s.h, s.target);
+    }
+    while (total > budget) {
+        TexStream* big = NULL;
+        size_t bigBytes = 0;
+        for (TexStream& s : g_texStream) {
+            size_t b = s.levels ? mipChainBytes(s.w, s.h, s.target) : 0;
+            if (s.levels && s.target < s.levels - 1 && b > bigBytes) { big = &s; bigBytes = b; }
+        }
+        if (!big) break;
+        big->target++;
+        total += mipChainBytes(big->w, big->h, big->target) - bigBytes;
+    }
+}
+
+// offline renders and the perf suite: the finest chains the budget allows,
+// loaded up front so frames don't depend on streaming timing
+void texStreamLoadAll() {
+    g_texStreamOn = 0;
+    for (TexStream& s : g_texStream) s.want = 0;
+    texFitBudget();
+    TexRequest req[MAT_LAYERS];
+    int n = 0;
+    for (int i = 0; i < MAT_LAYERS; ++i)
+        if (g_texStream[i].levels && g_texStream[i].target != g_texStream[i].resident) req[n++] = TexRequest{ i, g_texStream[i].target, 0 };
+    texLoadNow(req, n);
+}
+
+// texels per tile each material's closest visible surface needs, from its
+// distance and the projection; tiles per unit as the draw code maps them
+static void texFootprints(float need[MAT_LAYERS]) {
+    struct Footprint { int mat, obj; float bmin[3], bmax[3], tilesPerUnit; };
+    const float x0 = -ROOM_W * 0.5f, x1 = ROOM_W * 0.5f, z0 = -ROOM_D * 0.5f, z1 = ROOM_D * 0.5f;
+    const float wallTiles = std::max(kWallTileU / ROOM_W, kWallTileV / ROOM_H);
+    Footprint fp[16] = {
+        { MAT_FLOOR, -1, { x0, 0.0f, z0 }, { x1, 0.0f, z1 }, kFloorTile / ROOM_W },
+        { MAT_CEIL, -1, { x0, ROOM_H, z0 }, { x1, ROOM_H, z1 }, kCeilTile / ROOM_W },
+        { MAT_WALL, -1, { x0, 0.0f, z0 }, { x0, ROOM_H, z1 }, wallTiles },
+        { MAT_WALL, -1, { x1, 0.0f, z0 }, { x1, ROOM_H, z1 }, wallTiles },
+        { MAT_WALL, -1, { x0, 0.0f, z0 }, { x1, ROOM_H, z0 }, wallTiles },
+        { MAT_WALL, -1, { x0, 0.0f, z1 }, { x1, ROOM_H, z1 }, wallTiles },
+        { MAT_PAINTING, -1, { -kPaintingW * 0.5f, kPaintingY - kPaintingH * 0.5f, z0 }, { kPaintingW * 0.5f, kPaintingY + kPaintingH * 0.5f, z0 },
+            std::max(1.0f / kPaintingW, 1.0f / kPaintingH) },
+    };
+    int n = 7;
+    for (int o = OBJ_TABLE; o <= OBJ_CHAIR3; ++o) {
+        // the table top spans 1.5 tiles, the chair seats one
+        const SceneObject& so = g_objects[o];
+        Footprint f = { MAT_WOOD, o, { so.bmin[0], so.bmin[1], so.bmin[2] }, { so.bmax[0], so.bmax[1], so.bmax[2] },
+            (o == OBJ_TABLE ? 1.5f : 1.0f) / std::max(0.1f, std::min(so.bmax[0] - so.bmin[0], so.bmax[2] - so.bmin[2])) };
+        fp[n++] = f;
+    }
+    const SceneObject& e = g_objects[OBJ_EARTH];
+    fp[n++] = { MAT_EARTH, OBJ_EARTH, { e.bmin[0], e.bmin[1], e.bmin[2] }, { e.bmax[0], e.bmax[1], e.bmax[2] },
+        1.0f / (3.14159265f * std::max(0.01f, e.bmax[0] - e.bmin[0])) };   // one tile around the equator
+
+    float planes[6][4];
+    frustumPlanes(g_viewProj, planes);
+    float k = use_perspective ? win_height / (2.0f * tanf(fovy * 0.5f * DEG2RAD)) : win_height / (2.0f * ortho_scale);
+    for (int i = 0; i < MAT_LAYERS; ++i) need[i] = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        const Footprint& f = fp[i];
+        if (f.obj >= 0 && !g_objects[f.obj].visible) continue;
+        int outside = 0;
+        for (int p = 0; p < 6 && !outside; ++p)
+            outside = planes[p][0] * (planes[p][0] > 0 ? f.bmax[0] : f.bmin[0]) + planes[p][1] * (planes[p][1] > 0 ? f.bmax[1] : f.bmin[1]) +
+                planes[p][2] * (planes[p][2] > 0 ? f.bmax[2] : f.bmin[2]) + planes[p][3] < 0.0f;
+        if (outside) continue;
+        float dx = std::max(f.bmin[0] - eyeX, std::max(0.0f, eyeX - f.bmax[0]));
+        float dy = std::max(f.bmin[1] - eyeY, std::max(0.0f, eyeY - f.bmax[1]));
+        float dz = std::max(f.bmin[2] - eyeZ, std::max(0.0f, eyeZ - f.bmax[2]));
+        float ppu = use_perspective ? k / std::max(len3(dx, dy, dz), z_near) : k;
+        need[f.mat] = std::max(need[f.mat], ppu / f.tilesPerUnit);
+    }
+}
+
+// per frame, after culling: pick levels, fit the budget, request changes
+void texStreamUpdate() {
+    if (!g_texStreamOn) return;
+    PROFILE_FUNCTION();
+    float need[MAT_LAYERS];
+    texFootprints(need);
+    for (TexStream& s : g_texStream) {
+        if (!s.levels) continue;
+        // coarsest level that still has a texel per pixel; never coarser than the startup level
+        int l = 0, size = std::max(s.w, s.h);
+        while (l + 1 < s.levels && (size >> (l + 1)) >= need[&s - g_texStream]) ++l;
+        s.want = std::min(l, texStartLevel(s.w, s.h));
+    }
+    texFitBudget();
+    int overBudget = texResidentBytes() > texStreamBudget();
+    for (int i = 0; i < MAT_LAYERS; ++i) {
+        TexStream& s = g_texStream[i];
+        if (!s.levels || s.pending >= 0) continue;
+        if (s.target < s.resident) {
+            texRequest(i, s.target, 0);
+            s.coarserFrames = 0;
+        }
+        else if (s.target > s.resident && (s.target > s.want || overBudget || ++s.coarserFrames >= TEX_DROP_FRAMES)) {
+            texDrop(i, s.target);   // the budget says so, or it has been enough for a while
+            s.coarserFrames = 0;
+        }
+        else if (s.target <= s.resident) s.coarserFrames = 0;
+    }
+}
+
+// main thread, once per frame: apply edits, queue what the loader finished,
+// then upload under the per-frame budget and swap each texture in once all
+// of its levels, and its array layer's, are there. Returns 1 when the
+// picture may have changed.
+int texLoaderApply() {
+    int applied = 0;
+    if (g_hot.cfgChanged.exchange(0) && loadSceneConfig(kSceneConfig)) {
+        applyProjection();
+        printf("Hot reload: %s\n", kSceneConfig);
+        applied = 1;
+    }
+    int changed = g_hot.filesChanged.exchange(0);
+    for (int i = 0; i < MAT_LAYERS; ++i)
+        if (changed & (1 << i)) texRequest(i, g_texStream[i].levels ? g_texStream[i].resident : -1, 1);
+    {
+        std::lock_guard<std::mutex> lk(g_hot.mtx);
+        for (HotImage& img : g_hot.ready) {
+            if (img.tex.empty()) {  // decode failed
+                if (g_texStream[img.mat].pending == img.base) g_texStream[img.mat].pending = -1;
+                continue;
+            }
+            for (HotUpload& u : g_hot.uploads)
+                if (u.img.mat == img.mat) u.img.tex.clear();    // superseded: finish as a no-op
+            ALLOC_CHECK_SETTLE();
+            g_hot.uploads.push_back(HotUpload{ std::move(img), 0, 0, 0, 0, 0, 0.0f });
+        }
+        g_hot.ready.clear();
+    }
+    if (g_hot.uploads.empty()) return applied;
+    double t0 = nowMs();
+    size_t budget = HOT_UPLOAD_BYTES;
+    while (!g_hot.uploads.empty() && budget > 0) {
+        HotUpload& u = g_hot.uploads.front();
+        if (u.img.tex.empty()) {
+            if (u.id) glDeleteTextures(1, &u.id);
+            if (u.layerId) glDeleteTextures(1, &u.layerId);
+            g_hot.uploads.pop_front();
+            continue;
+        }
+        if (!u.id) {
+            u.id = texAllocate(u.img.tex);
+            if (!u.img.layer.empty() && (GLEW_VERSION_4_3 || GLEW_ARB_copy_image)) u.layerId = texAllocate(u.img.layer);
+        }
+        // a band of rows of the current level: the texture's chain first,
+        // then the staged array layer's (reloads only)
+        int texLevels = (int)u.img.tex.size(), l = u.level - texLevels;
+        int levels = texLevels + (u.layerId ? (int)u.img.layer.size() : 0);
+        const HotLevel& lv = l < 0 ? u.img.tex[u.level] : u.img.layer[l];
+        int rows = (int)std::min<size_t>(lv.h - u.row, std::max<size_t>(1, budget / ((size_t)lv.w * 4)));
+        glBindTexture(GL_TEXTURE_2D, l < 0 ? u.id : u.layerId);
+        glTexSubImage2D(GL_TEXTURE_2D, l < 0 ? u.level : l, 0, u.row, lv.w, rows, GL_RGBA, GL_UNSIGNED_BYTE, &lv.px[(size_t)u.row * lv.w * 4]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        budget -= std::min(budget, (size_t)rows * lv.w * 4);
+        u.row += rows;
+        if (u.row < lv.h) break;
+        u.row = 0;
+        if (++u.level < levels) continue;
+
+        if (!u.img.layer.empty()) texLayerSwapIn(u.img, u.layerId);
+        if (u.layerId) glDeleteTextures(1, &u.layerId);
+        texSwapIn(u.img, u.id);
+        u.maxMs = fmaxf(u.maxMs, (float)(nowMs() - t0));
+        if (!u.img.layer.empty())
+            printf("Hot reload: %s (%dx%d) over %d frames, at most %.2f ms per frame\n", kMatFile[u.img.mat],
+                u.img.w, u.img.h, u.frames + 1, u.maxMs);
+        g_hot.uploads.pop_front();
+        return 1;
+    }
+    if (!g_hot.uploads.empty()) {
+        HotUpload& u = g_hot.uploads.front();
+        u.frames++;
+        u.maxMs = fmaxf(u.maxMs, (float)(nowMs() - t0));
+    }
+    return 1;
+}
+
+// ---------------- Stress scenes (perf suite) ----------------
+// Extra content for load testing: a grid of chairs over the floor and a
+// building of copies of the room around the real one. Each item is culled
+// with the same occlusion buffer as the stock objects.
+int g_stressChairs = 0;             // extra chairs
+int g_stressRooms = 0;              // building is g_stressRooms x g_stressRooms rooms (0: off)
+int g_stressDrawn = 0;
+float g_stressMergeMs = 0.0f;       // serial part of recording
+std::vector<ChairPlacement> g_stressChairPos;
+float g_stressChairScale = 1.0f;
+
+void buildStressScene() {
+    buildSceneLights(g_stressRooms > 0 ? g_stressRooms * g_stressRooms : 1);
+    g_stressChairPos.clear();
+    if (g_stressChairs <= 0) return;
+    int side = (int)ceilf(sqrtf((float)g_stressChairs));
+    float spacing = (ROOM_W - 0.6f) / side;
+    g_stressChairScale = fminf(1.0f, spacing / 0.6f);
+    for (int i = 0; i < g_stressChairs; ++i) {
+        ChairPlacement c = { -ROOM_W * 0.5f + 0.3f + (i % side + 0.5f) * spacing, -ROOM_D * 0.5f + 0.3f + (i / side + 0.5f) * spacing,
+            (float)((i * 37) % 360) };
+        g_stressChairPos.push_back(c);
+    }
+}
+
+static int stressVisible(const float* bmin, const float* bmax) {
+    return !occlusion_on || occTestBounds(bmin, bmax) == 0;
+}
+
+// Recording is split into chunks of STRESS_CHUNK items that run as jobs.
+// Each chunk culls its items, picks the bulb LOD and writes a sorted
+// command list into its own slice of the frame arena. The main thread merges
+// the lists by sort key (chairs, then rooms, each front to back) and is the
+// only thread that makes GL calls.
+#define STRESS_CHUNK 64
+
+enum { STRESS_CHAIR, STRESS_ROOM };
+struct StressCmd { uint64_t key; int kind, index, light, lod; float x, z; };
+const StressCmd* g_stressCmd = nullptr;     // this frame's merged list (frame arena), shared by both passes
+struct StressRecording {
+    int items, chunks;
+    StressCmd* cmd;         // chunk c writes from cmd + c * STRESS_CHUNK
+    int* count;             // commands per chunk
+};
+
+// item ids are unique, so the merged order does not depend on the chunking
+static uint64_t stressSortKey(int kind, float x, float z, int item) {
+    float d = (x - eyeX) * (x - eyeX) + (z - eyeZ) * (z - eyeZ);
+    uint32_t bits;
+    memcpy(&bits, &d, sizeof(bits));    // non-negative floats order like their bits
+    return (uint64_t)kind << 56 | (uint64_t)bits << 24 | (uint32_t)item;
+}
+
+// ids [0, chairs) are chairs, the rest walk the building row by row
+static void stressRecordChunk(int chunk, void* ctx) {
+    PROFILE_FUNCTION();
+    StressRecording& R = *(StressRecording*)ctx;
+    const float s = g_stressChairScale;
+    const int chairs = (int)g_stressChairPos.size(), n = g_stressRooms, real = (n / 2) * n + n / 2;
+    const int i0 = chunk * STRESS_CHUNK, i1 = std::min(i0 + STRESS_CHUNK, R.items);
+    StressCmd* out = R.cmd + i0;
+    int k = 0;
+    for (int id = i0; id < i1; ++id) {
+        StressCmd c = {};
+        float bmin[3], bmax[3];
+        if (id < chairs) {
+            const ChairPlacement& p = g_stressChairPos[id];
+            c.kind = STRESS_CHAIR; c.index = id; c.x = p.x; c.z = p.z;
+            bmin[0] = p.x - 0.33f * s; bmin[1] = 0.0f; bmin[2] = p.z - 0.33f * s;
+            bmax[0] = p.x + 0.33f * s; bmax[1] = 0.9f * s; bmax[2] = p.z + 0.33f * s;
+        }
+        else {
+            int r = id - chairs;
+            if (r == real) continue;
+            c.kind = STRESS_ROOM; c.index = r;
+            c.light = r < real ? r + 1 : r;     // light 0 is the real room's
+            c.x = (r / n - n / 2) * ROOM_W; c.z = (r % n - n / 2) * ROOM_D;
+            bmin[0] = c.x - ROOM_W * 0.5f; bmin[1] = 0.0f; bmin[2] = c.z - ROOM_D * 0.5f;
+            bmax[0] = c.x + ROOM_W * 0.5f; bmax[1] = ROOM_H; bmax[2] = c.z + ROOM_D * 0.5f;
+        }
+        if (!stressVisible(bmin, bmax)) continue;
+        if (c.kind == STRESS_ROOM)
+            c.lod = selectLod(g_sphereMesh, 3, SPHERE_LODS, 0.08f, pixelsPerUnit(c.x, kLampAnchorY - kLampCordLen, c.z));
+        c.key = stressSortKey(c.kind, c.x, c.z, id);
+        out[k++] = c;
+    }
+    std::sort(out, out + k, [](const StressCmd& a, const StressCmd& b) { return a.key < b.key; });
+    R.count[chunk] = k;
+}
+
+// records as jobs, then merges the sorted chunk lists pairwise; *list
+// points into the frame arena
+static int stressRecord(const StressCmd** list) {
+    StressRecording R;
+    R.items = (int)g_stressChairPos.size() + g_stressRooms * g_stressRooms;
+    R.chunks = (R.items + STRESS_CHUNK - 1) / STRESS_CHUNK;
+    R.cmd = frameAlloc<StressCmd>(R.items);
+    R.count = frameAlloc<int>(R.chunks);
+    jobParallelFor(R.chunks, stressRecordChunk, &R, 1);
+
+    PROFILE_ZONE("stressMerge");
+    double t0 = nowMs();
+    struct Run { StressCmd* at; int n; };
+    Run* runs = frameAlloc<Run>(R.chunks);
+    int runCount = 0, total = 0;
+    for (int c = 0; c < R.chunks; ++c)
+        if (R.count[c]) { runs[runCount++] = Run{ R.cmd + c * STRESS_CHUNK, R.count[c] }; total += R.count[c]; }
+    StressCmd* buf[2] = { frameAlloc<StressCmd>(total), frameAlloc<StressCmd>(total) };
+    auto byKey = [](const StressCmd& a, const StressCmd& b) { return a.key < b.key; };
+    if (runCount == 1) std::copy(runs[0].at, runs[0].at + total, buf[0]);
+    for (int pass = 0; runCount > 1; ++pass) {
+        StressCmd* dst = buf[pass & 1];
+        int merged = 0;
+        for (int r = 0; r < runCount; r += 2) {
+            Run m = { dst, runs[r].n };
+            if (r + 1 < runCount) {
+                std::merge(runs[r].at, runs[r].at + runs[r].n, runs[r + 1].at, runs[r + 1].at + runs[r + 1].n, dst, byKey);
+                m.n += runs[r + 1].n;
+            }
+            else std::copy(runs[r].at, runs[r].at + runs[r].n, dst);
+            dst += m.n;
+            runs[merged++] = m;
+        }
+        runCount = merged;
+    }
+    *list = runCount ? runs[0].at : buf[0];
+    g_stressMergeMs = (float)(nowMs() - t0);
+    return total;
+}
+
+void drawStressScene() {
+    if (!g_stressChairs && !g_stressRooms) return;
+    PROFILE_FUNCTION();
+    GL_STATS_SCOPE("drawStressScene");
+    if (!g_prepassDone) g_stressDrawn = stressRecord(&g_stressCmd);
+
+    const float s = g_stressChairScale;
+    for (int k = 0; k < g_stressDrawn; ++k) {
+        const StressCmd& c = g_stressCmd[k];
+        glPushMatrix();
+        glTranslatef(c.x, 0.0f, c.z);
+        if (c.kind == STRESS_CHAIR) {
+            glRotatef(g_stressChairPos[c.index].rotY, 0, 1, 0); glScalef(s, s, s); drawChair();
+            glPopMatrix();
+            continue;
+        }
+        if (!g_frontToBack) drawRoom();
+        drawTable();
+        for (int i = 0; i < 4; ++i) {
+            glPushMatrix(); glTranslatef(g_chairs[i].x, 0.0f, g_chairs[i].z); glRotatef(g_chairs[i].rotY, 0, 1, 0); drawChair(); glPopMatrix();
+        }
+        // the room's own bulb, flickering on its own
+        float f = g_lightAnim.out[c.light];
+        GLfloat emit[4] = { 1.0f * f, 0.96f * f, 0.85f * f, 1.0f }, zero[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, emit);
+        glColor3f(1.0f, 1.0f, 0.85f);
+        glTranslatef(0.0f, kLampAnchorY - kLampCordLen, 0.0f); glScalef(0.08f, 0.08f, 0.08f);
+        drawMesh(g_sphereMesh[c.lod]);
+        glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, zero);
+        glPopMatrix();
+        if (!g_frontToBack) continue;
+        glPushMatrix(); glTranslatef(c.x, 0.0f, c.z); drawRoom(); glPopMatrix();
+    }
+}
+
+// ---------------- Input latency ----------------
+// A frame that consumed input carries the time of its oldest event through
+// simulate -> submit -> swap. After the swap, a fence and a timestamp query
+// report when the GPU finished the frame. The query result is mapped onto
+// the CPU clock with a GL_TIMESTAMP read taken at the swap, so completion
+// isn't rounded up to whenever the fence happens to be polled. Scanout adds
+// up to one more refresh that GL cannot see; without sync objects the
+// estimate stops at the swap.
+#define LAT_INFLIGHT 8
+#define LAT_HISTORY 256
+enum { LAT_SIM, LAT_SUBMIT, LAT_SWAP, LAT_GPU, LAT_STAGES };
+struct LatencyFrame { double input, sim, submit, swap, gpuToCpu; GLsync fence; GLuint query; };
+struct LatencyTracker {
+    double pendingLook, pendingOther;   // oldest unconsumed event of each kind (0: none)
+    double frameInput, frameSim;        // input consumed for the frame display() draws next
+    double submit;
+    LatencyFrame inflight[LAT_INFLIGHT];
+    float total[LAT_HISTORY], stage[LAT_STAGES][LAT_HISTORY];
+    int count, next;
+};
+LatencyTracker g_latency = {};
+int g_lateLatch = 0;    // H: display() re-samples look input just before drawing
+
+// look events (mouse, arrows) are the ones late latching can pick up
+void latencyInputEvent(int look) {
+    double& p = look ? g_latency.pendingLook : g_latency.pendingOther;
+    if (p == 0.0) p = nowMs();
+}
+
+void latencyConsumeInput(int lookOnly) {
+    LatencyTracker& L = g_latency;
+    double in = L.pendingLook;
+    if (!lookOnly && L.pendingOther != 0.0 && (in == 0.0 || L.pendingOther < in)) in = L.pendingOther;
+    L.pendingLook = 0.0;
+    if (!lookOnly) L.pendingOther = 0.0;
+    if (in == 0.0) return;
+    if (L.frameInput == 0.0 || in < L.frameInput) L.frameInput = in;
+    L.frameSim = nowMs();
+}
+
+static void latencyRecord(const LatencyFrame& f, double done) {
+    LatencyTracker& L = g_latency;
+    int i = L.next;
+    L.total[i] = (float)(done - f.input);
+    L.stage[LAT_SIM][i] = (float)(f.sim - f.input);
+    L.stage[LAT_SUBMIT][i] = (float)(f.submit - f.sim);
+    L.stage[LAT_SWAP][i] = (float)(f.swap - f.submit);
+    L.stage[LAT_GPU][i] = (float)std::max(0.0, done - f.swap);
+    L.next = (i + 1) % LAT_HISTORY;
+    if (L.count < LAT_HISTORY) ++L.count;
+}
+
+// retires frames whose fence has signalled; never blocks
+void latencyPoll() {
+    for (LatencyFrame& f : g_latency.inflight) {
+        if (!f.fence) continue;
+        GLenum r = glClientWaitSync(f.fence, 0, 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) continue;
+        double done = nowMs();
+        GLint ready = 0;
+        if (f.query) glGetQueryObjectiv(f.query, GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (ready) {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(f.query, GL_QUERY_RESULT, &ns);
+            done = std::min(done, ns * 1e-6 + f.gpuToCpu);
+        }
+        latencyRecord(f, done);
+        glDeleteSync(f.fence);
+        f.fence = 0;
+    }
+}
+
+void latencySubmitted() { g_latency.submit = nowMs(); }
+
+void latencySwapped() {
+    LatencyTracker& L = g_latency;
+    if (L.frameInput == 0.0) return;
+    LatencyFrame f = { L.frameInput, L.frameSim, L.submit, nowMs(), 0.0, 0, 0 };
+    L.frameInput = 0.0;
+    if (!g_capSupported) { latencyRecord(f, f.swap); return; }
+    latencyPoll();
+    LatencyFrame* slot = NULL;
+    for (LatencyFrame& s : L.inflight) if (!s.fence) { slot = &s; break; }
+    if (!slot) return;  // the GPU is more than LAT_INFLIGHT input frames behind; skip this one
+    f.query = slot->query;
+    if (g_gpuTimersSupported) {
+        if (!f.query) glGenQueries(1, &f.query);
+        GLint64 gpuNs = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNs);
+        f.gpuToCpu = nowMs() - gpuNs * 1e-6;
+        glQueryCounter(f.query, GL_TIMESTAMP);
+    }
+    f.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    *slot = f;
+}
+
+float latencyPercentile(const float* v, float p) {
+    int n = g_latency.count;
+    float* s = frameAlloc<float>(n);
+    memcpy(s, v, n * sizeof(float));
+    return percentileInPlace(s, n, p);
+}
+
+// ---------------- Input (smoothed with key states) ----------------
+// Mouse look: motion callbacks only sum raw pixel deltas; idle() turns the
+// whole sum into yaw/pitch once per step, so the rotation depends on how far
+// the mouse moved and not on how many frames that took. The pointer is
+// warped back to the centre when it strays. Every event moves relative to
+// the last one, except the synthetic event the warp itself produces, which
+// lands exactly on the centre and only moves the origin. If that event has
+// not shown up after MOUSE_WARP_TIMEOUT_MS, the warp is assumed to have
+// landed without one.
+#define MOUSE_WARP_TIMEOUT_MS 100.0
+struct MouseLook {
+    int captured, warpPending;
+    int lastX, lastY, warpX, warpY;
+    double warpMs;              // when the pending warp was issued
+    long accX, accY;            // pixels since the last step
+    float pendYaw, pendPitch;   // degrees not yet applied (smoothing)
+};
+MouseLook g_mouse = {};
+void requestRedraw();
+
+static void mouseWarpToCenter() {
+    g_mouse.warpPending = 1;
+    g_mouse.warpX = win_width / 2; g_mouse.warpY = win_height / 2;
+    g_mouse.warpMs = nowMs();
+    glutWarpPointer(g_mouse.warpX, g_mouse.warpY);
+}
+
+static void mouseCapture(int on, int x, int y) {
+    g_mouse.captured = on;
+    g_mouse.lastX = x; g_mouse.lastY = y;
+    g_mouse.warpPending = 0;
+    glutSetCursor(on ? GLUT_CURSOR_NONE : GLUT_CURSOR_INHERIT);
+    if (on) mouseWarpToCenter();
+}
+
+void mouseMotion(int x, int y) {
+    MouseLook& m = g_mouse;
+    if (!m.captured) return;
+    latencyInputEvent(1);
+    requestRedraw();
+    if (m.warpPending && x == m.warpX && y == m.warpY) {    // the warp landed: new origin, no motion
+        m.warpPending = 0;
+        m.lastX = x; m.lastY = y;
+        return;
+    }
+    if (m.warpPending && nowMs() - m.warpMs > MOUSE_WARP_TIMEOUT_MS) {   // it landed without an event
+        m.warpPending = 0;
+        m.lastX = m.warpX; m.lastY = m.warpY;
+    }
+    // events queued before the warp still move relative to the old position
+    m.accX += x - m.lastX; m.accY += y - m.lastY;
+    m.lastX = x; m.lastY = y;
+    if (!m.warpPending && (abs(x - win_width / 2) > win_width / 4 || abs(y - win_height / 2) > win_height / 4))
+        mouseWarpToCenter();
+}
+
+// applies the motion gathered since the last step; with smoothing, the part
+// not applied yet carries over, so the total turn is always exact
+static void mouseLookStep(float dt) {
+    MouseLook& m = g_mouse;
+    m.pendYaw += m.accX * mouseSensitivity;
+    m.pendPitch -= m.accY * mouseSensitivity;   // window y grows downwards
+    m.accX = m.accY = 0;
+    float k = mouseSmoothing > 0.0f ? 1.0f - expf(-dt / mouseSmoothing) : 1.0f;
+    if (fabsf(m.pendYaw) + fabsf(m.pendPitch) < 1e-3f) k = 1.0f;
+    float dy = m.pendYaw * k, dp = m.pendPitch * k;
+    m.pendYaw -= dy; m.pendPitch -= dp;
+    yawDeg += dy;
+    pitchDeg = clampf(pitchDeg + dp, -89.0f, 89.0f);
+}
+
+// arrow keys and mouse, integrated up to now on their own clock so idle()
+// and a late-latching display() can both call it without double counting
+double g_lookLastMs = 0.0;
+void updateLook() {
+    double now = nowMs();
+    float dt = g_lookLastMs > 0.0 ? (float)(now - g_lookLastMs) * 0.001f : 0.0f;
+    g_lookLastMs = now;
+    float yawRate = 0.0f, pitchRate = 0.0f;
+    if (gSpecialKeyDown[GLUT_KEY_LEFT]) yawRate -= lookSpeed;
     if (gSpecialKeyDown[GLUT_KEY_RIGHT]) yawRate += lookSpeed;
     if (gSpecialKeyDown[GLUT_KEY_UP]) pitchRate += lookSpeed;
     if (gSpecialKeyDown[GLUT_KEY_DOWN]) pitchRate -= lookSpeed;
     yawDeg += yawRate * dt;
     pitchDeg = clampf(pitchDeg + pitchRate * dt, -89.0f, 89.0f);
+    mouseLookStep(dt);
+}
+
+static void updateBoostFromModifiers() {
+    int mod = glutGetModifiers();
+    boostActive = (mod & GLUT_ACTIVE_SHIFT) ? 1 : 0;
+}
+
+void keyboardDown(unsigned char key, int x, int y) {
+    gKeyDown[(unsigned char)key] = 1;
+    ALLOC_CHECK_SETTLE();
+    latencyInputEvent(0);
+    updateBoostFromModifiers();
+
+    // one-shot actions
+    switch (key) {
+    case 'p': use_perspective = !use_perspective; applyProjection(); break;
+    case 'z': if (use_perspective) { fovy = clampf(fovy - 2.0f, 20.0f, 90.0f); }
+            else { ortho_scale = clampf(ortho_scale * 0.9f, 1.0f, 10.0f); } applyProjection(); break;
+    case 'x': if (use_perspective) { fovy = clampf(fovy + 2.0f, 20.0f, 90.0f); }
+            else { ortho_scale = clampf(ortho_scale / 0.9f, 1.0f, 10.0f); } applyProjection(); break;
+    case 'm': animate_on = !animate_on; break;
+    case 't': showAxes = !showAxes; break;
+    case 'i': showStats = !showStats; break;
+    case 'o': occlusion_on = !occlusion_on; break;
+    case 'l': lod_on = !lod_on; break;
+    case 'k': g_batch_on = !g_batch_on; break;
+    case 'j': g_gpuDriven_on = !g_gpuDriven_on; break;
+    case 'h': g_lateLatch = !g_lateLatch; break;
+    case 'c': g_captureOne = 1; break;
+    case 'v': g_captureContinuous = !g_captureContinuous; break;
+    case 'b': g_post_on = !g_post_on; break;
+    case 'n': g_postPreset = (g_postPreset + 1) % POST_PRESETS; break;
+    case 'f': g_volfog_on = !g_volfog_on; break;
+    case 'g': g_dynres_on = !g_dynres_on; g_dynres.scale = 1.0f; g_dynres.err1 = g_dynres.err2 = 0.0f; break;
+    case 'r': eyeX = 3.0f; eyeY = 1.2f; eyeZ = 3.5f; yawDeg = -135.0f; pitchDeg = -8.0f;
+        fovy = 60.0f; ortho_scale = 3.5f; use_perspective = 1; velX = velY = velZ = 0; applyProjection(); break;
+    case '\t': mouseCapture(!g_mouse.captured, x, y); break;
+    case 'u': g_onDemand = !g_onDemand; break;
+    case 27:  if (g_mouse.captured) mouseCapture(0, x, y); else exit(0); break; // ESC: release the mouse, then quit
+    }
+    requestRedraw();
+}
+void keyboardUp(unsigned char key, int x, int y) {
+    gKeyDown[(unsigned char)key] = 0;
+    latencyInputEvent(0);
+    updateBoostFromModifiers();
+    requestRedraw();
+}
+void onSpecialDown(int key, int x, int y) {
+    gSpecialKeyDown[key] = 1;
+    ALLOC_CHECK_SETTLE();
+    latencyInputEvent(key >= GLUT_KEY_LEFT && key <= GLUT_KEY_DOWN);
+    updateBoostFromModifiers();
+    switch (key) {
+    case GLUT_KEY_F2: g_depthPrepass = !g_depthPrepass; g_overdrawSwitchFrame = g_frameIndex; break;
+    case GLUT_KEY_F3: g_frontToBack = !g_frontToBack; g_overdrawSwitchFrame = g_frameIndex; break;
+    case GLUT_KEY_F4: g_overdrawView = !g_overdrawView; g_overdrawSwitchFrame = g_frameIndex; break;
+    case GLUT_KEY_F5: g_postBloom = !g_postBloom; break;
+    case GLUT_KEY_F6: g_postVignette = !g_postVignette; break;
+    case GLUT_KEY_F7: g_postGrain = !g_postGrain; break;
+    case GLUT_KEY_F8: aaCycle(); break;
+    case GLUT_KEY_F9: PROFILE_DUMP(); break;
+    }
+    requestRedraw();
+}
+void onSpecialUp(int key, int x, int y) {
+    gSpecialKeyDown[key] = 0;
+    latencyInputEvent(key >= GLUT_KEY_LEFT && key <= GLUT_KEY_DOWN);
+    updateBoostFromModifiers();
+    requestRedraw();
+}
+
+// ---------------- Stats overlay (I) ----------------
+void displayStats(float x, float y, float lh, void* font) {
+    char buf[160];
+    glColor3f(0.7f, 1.0f, 0.7f);
+    snprintf(buf, sizeof(buf), "Frame %.2f ms (%.0f fps)%s", g_frameMs, g_frameMs > 0 ? 1000.0f / g_frameMs : 0.0f,
+        g_onDemand ? "  redraw on demand" : "");
+    renderBitmapString(x, y, font, buf); y -= lh;
+    snprintf(buf, sizeof(buf), "Occlusion %s: drawn %d/%d  occluded %d  outside %d  occluder tris %d  cost %.3f ms",
+        occlusion_on ? "on" : "off", g_occStats.drawn, g_occStats.tested, g_occStats.occluded,
+        g_occStats.outside, g_occStats.occluderTris, g_occStats.costMs);
+    renderBitmapString(x, y, font, buf); y -= lh;
+    snprintf(buf, sizeof(buf), "Meshes: %d tris  LOD %s (bulb %dx%d, shade %dx%d, earth %dx%d)", g_meshTris,
+        lod_on ? "on" : "off", kSphereLod[g_bulbLod][0], kSphereLod[g_bulbLod][1],
+        kTorusLod[g_shadeLod][0], kTorusLod[g_shadeLod][1], kSphereLod[g_earthLod][0], kSphereLod[g_earthLod][1]);
+    renderBitmapString(x, y, font, buf); y -= lh;
+    if (gpuDrivenActive()) snprintf(buf, sizeof(buf), "Static batch: superseded by the GPU-driven path");
+    else if (g_batch_on && g_batchSupported) snprintf(buf, sizeof(buf), "Static batch: %d draws, %d layers at %dx%d", g_batchDraws, MAT_LAYERS, g_matSize, g_matSize);
+    else snprintf(buf, sizeof(buf), "Static batch: off%s", g_batchSupported ? "" : " (unsupported)");
+    renderBitmapString(x, y, font, buf); y -= lh;
+    if (gpuDrivenActive())
+        snprintf(buf, sizeof(buf), "GPU-driven: %u/%d objects, %u tris, cull %.3f ms, 1 dispatch + 1 MDI",
+            g_gpuStats[0], GOBJ_COUNT, g_gpuStats[1], g_gpuCullTimer.ms);
+    else snprintf(buf, sizeof(buf), "GPU-driven: off%s", g_gpuDrivenSupported ? "" : " (unsupported)");
+    renderBitmapString(x, y, font, buf); y -= lh;
+    if (g_flatProg) {
+        int n = snprintf(buf, sizeof(buf), "Overdraw %s: shaded samples/px, GPU ms |", kOrderModeName[orderMode()]);
+        for (int m = 0; m < ORDER_MODES && n < (int)sizeof(buf); ++m) {
+            if (g_overdraw[m] > 0.0f) n += snprintf(buf + n, sizeof(buf) - n, "  %s %.2f", kOrderModeName[m], g_overdraw[m]);
+            else n += snprintf(buf + n, sizeof(buf) - n, "  %s -", kOrderModeName[m]);
+            if (n >= (int)sizeof(buf)) break;
+            if (g_overdrawFrameMs[m] > 0.0f) n += snprintf(buf + n, sizeof(buf) - n, " %.2f", g_overdrawFrameMs[m]);
+            else n += snprintf(buf + n, sizeof(buf) - n, " -");
+        }
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+    if (g_latency.count) {
+        const LatencyTracker& L = g_latency;
+        snprintf(buf, sizeof(buf), "Input latency%s: p50 %.1f  p95 %.1f  p99 %.1f ms | sim %.1f  submit %.1f  swap %.1f  %s %.1f | late latch %s",
+            g_capSupported ? "" : " (to swap)", latencyPercentile(L.total, 0.5f), latencyPercentile(L.total, 0.95f),
+            latencyPercentile(L.total, 0.99f), latencyPercentile(L.stage[LAT_SIM], 0.5f), latencyPercentile(L.stage[LAT_SUBMIT], 0.5f),
+            latencyPercentile(L.stage[LAT_SWAP], 0.5f), g_gpuTimersSupported ? "gpu" : "fence", latencyPercentile(L.stage[LAT_GPU], 0.5f),
+            g_lateLatch ? "on" : "off");
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+    {
+        int n = snprintf(buf, sizeof(buf), "Textures: %.1f + %.1f array / %.0f MB, top mip", texResidentBytes() / 1048576.0,
+            texArrayBytes() / 1048576.0, g_texBudgetMB);
+        for (int i = 0; i < MAT_LAYERS; ++i) {
+            const TexStream& s = g_texStream[i];
+            if (!s.levels) continue;
+            n += snprintf(buf + n, sizeof(buf) - n, " %s %d", kMatShort[i], std::max(s.w, s.h) >> s.resident);
+            if (s.pending >= 0) n += snprintf(buf + n, sizeof(buf) - n, ">%d", std::max(s.w, s.h) >> s.pending);
+        }
+        snprintf(buf + n, sizeof(buf) - n, " | %d streamed, %d reloaded", g_hot.streamed, g_hot.reloads);
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+    snprintf(buf, sizeof(buf), "Transforms: %d nodes, %d recomputed", (int)g_xform.parent.size(), g_xform.updated);
+    renderBitmapString(x, y, font, buf); y -= lh;
+    {
+        int n = snprintf(buf, sizeof(buf), "Frame arena: peak %.1f of %zu KB x %d, %d frames spilled", g_frameArenaPeak / 1024.0,
+            g_frameArena->cap / 1024, FRAME_ARENAS, g_frameArenaSpills);
+#ifndef NDEBUG
+        snprintf(buf + n, sizeof(buf) - n, " | heap allocs %d%s", g_heapAllocsLast, g_allocSettle ? " (settling)" : "");
+#else
+        (void)n;
+#endif
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+    if (g_stream.buf) {
+        snprintf(buf, sizeof(buf), "Streaming: %zu B/frame (peak %zu of %d KB), %d fence waits %.2f ms%s",
+            g_stream.used, g_stream.peak, STREAM_REGION_BYTES / 1024, g_stream.waits, g_stream.waitMs, g_stream.mapped ? "" : ", staged");
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+    snprintf(buf, sizeof(buf), "Capture %s: issued %d  written %d  dropped %d  map %.3f ms",
+        g_captureContinuous ? "continuous" : "idle", g_capStats.issued, g_capWritten.load(), g_capStats.dropped, g_capStats.mapMs);
+    renderBitmapString(x, y, font, buf); y -= lh;
+    snprintf(buf, sizeof(buf), "Dyn-res %s: scale %.2f (%dx%d)  GPU frame %.2f ms  target %.1f ms",
+        g_dynres_on ? "on" : "off", g_dynres_on ? g_dynres.scale : 1.0f, g_sceneW, g_sceneH, g_gpuFrame.ms, g_dynresTargetMs);
+    renderBitmapString(x, y, font, buf); y -= lh;
+    if (g_post_on) {
+        snprintf(buf, sizeof(buf), "Post %s: bloom %d vignette %d grain %d | bright %.2f  blur1/2 %.2f  blur1/4 %.2f  composite %.2f ms",
+            kPostPresetName[g_postPreset], g_postBloom, g_postVignette, g_postGrain, g_gpuBright.ms,
+            g_postPreset != POST_LOW ? g_gpuBlurHalf.ms : 0.0f, g_gpuBlurQuarter.ms, g_gpuComposite.ms);
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+#ifdef ROOM_GL_STATS
+    {
+        const GlStats& gs = g_glStatsFrame;
+        int n = snprintf(buf, sizeof(buf), "GL calls: %u |", glStatsTotal(gs));
+        for (int c = 0; c < GLS_CATEGORIES && n < (int)sizeof(buf); ++c)
+            n += snprintf(buf + n, sizeof(buf) - n, " %s %u", kGlsCategoryName[c], glStatsCategory(gs, c));
+        renderBitmapString(x, y, font, buf); y -= lh;
+        // busiest draw functions first
+        int order[GLS_MAX_SCOPES];
+        for (int i = 0; i < g_glsScopes; ++i) order[i] = i;
+        for (int i = 1; i < g_glsScopes; ++i)
+            for (int j = i; j > 0 && glStatsScopeTotal(gs, order[j]) > glStatsScopeTotal(gs, order[j - 1]); --j) {
+                int t = order[j]; order[j] = order[j - 1]; order[j - 1] = t;
+            }
+        n = snprintf(buf, sizeof(buf), "GL by function:");
+        for (int i = 0; i < g_glsScopes && i < 7 && n < (int)sizeof(buf); ++i)
+            n += snprintf(buf + n, sizeof(buf) - n, " %s %u", g_glsScopeName[order[i]], glStatsScopeTotal(gs, order[i]));
+        renderBitmapString(x, y, font, buf); y -= lh;
+    }
+#endif
+    if (volfogActive()) snprintf(buf, sizeof(buf), "Fog: volumetric %dx%dx%d  %.2f ms%s", kFogGrid[0], kFogGrid[1], kFogGrid[2],
+        g_gpuFog.ms, g_volfogTemporal ? "" : " (no temporal)");
+    else snprintf(buf, sizeof(buf), "Fog: GL_EXP2%s", g_volfogSupported ? "" : " (volumetric unsupported)");
+    renderBitmapString(x, y, font, buf); y -= lh;
+    int n = snprintf(buf, sizeof(buf), "AA %s: %.2f ms | GPU frame:", kAaModeName[g_aaMode], g_gpuAA.ms);
+    for (int m = 0; m < AA_MODES && n < (int)sizeof(buf); ++m) {
+        if (!aaSupported(m)) continue;
+        if (g_aaFrameMs[m] > 0.0f) n += snprintf(buf + n, sizeof(buf) - n, "  %s %.2f", kAaModeName[m], g_aaFrameMs[m]);
+        else n += snprintf(buf + n, sizeof(buf) - n, "  %s -", kAaModeName[m]);
+    }
+    renderBitmapString(x, y, font, buf); y -= lh;
+}
+
+// ---------------- Display & idle ----------------
+// On-demand redraw (U) is for installations that sit idle most of the day.
+// Once nothing changes, idle() stops posting redisplays and unregisters
+// itself, so the process sleeps in the GLUT event loop. "Nothing changes"
+// means animation off, no movement keys held, the camera at rest, and no
+// mouse look, texture uploads or captures pending. Input, reshape and
+// exposure wake it. Hot-reload and loader results arrive on other threads,
+// so a slow timer checks for them while asleep. While the window is hidden,
+// nothing is simulated or drawn, in either mode. With temporal volumetric
+// fog, a full jitter cycle is drawn after the last change before sleeping,
+// so the frame left on screen has converged fog rather than one jittered
+// sample that the next wake-up would visibly move.
+#define ONDEMAND_REST_SPEED 1e-3f   // m/s
+#define ONDEMAND_POLL_MS 250
+int g_windowHidden = 0;
+int g_idleSuspended = 0;    // idle() is unregistered (or has been re-registered and not run yet)
+int g_pollArmed = 0;
+int g_settleFrames = VOLFOG_JITTER_FRAMES;    // redraws still owed to the fog history after the last change
+void idle();
+
+// (re)starts the jitter cycle owed once the scene is at rest
+static void onDemandSettle() {
+    g_settleFrames = volfogActive() && g_volfogTemporal ? VOLFOG_JITTER_FRAMES : 0;
+}
+
+static int sceneChanging(int moving) {
+    if (animate_on || moving || g_captureContinuous || g_captureOne) return 1;
+    for (int k = GLUT_KEY_LEFT; k <= GLUT_KEY_DOWN; ++k) if (gSpecialKeyDown[k]) return 1;
+    if (fabsf(velX) + fabsf(velY) + fabsf(velZ) > ONDEMAND_REST_SPEED) return 1;
+    if (g_mouse.accX || g_mouse.accY || fabsf(g_mouse.pendYaw) + fabsf(g_mouse.pendPitch) > 1e-3f) return 1;
+    for (const CaptureSlot& c : g_capSlots) if (c.fence) return 1;     // readback still to collect
+    return 0;
+}
+
+static void onDemandPoll(int) {
+    g_pollArmed = 0;
+    if (!g_idleSuspended || g_windowHidden) return;
+    int work = g_hot.cfgChanged.load() || g_hot.filesChanged.load();
+    {
+        std::lock_guard<std::mutex> lk(g_hot.mtx);
+        work |= !g_hot.ready.empty();
+    }
+    if (work) requestRedraw();
+    else { g_pollArmed = 1; glutTimerFunc(ONDEMAND_POLL_MS, onDemandPoll, 0); }
+}
+
+static void idleSuspend() {
+    glutIdleFunc(NULL);
+    g_idleSuspended = 1;
+    if (!g_windowHidden && !g_pollArmed) { g_pollArmed = 1; glutTimerFunc(ONDEMAND_POLL_MS, onDemandPoll, 0); }
+}
+
+// the clocks restart from now, so the time asleep isn't integrated as one step
+static void idleResume() {
+    g_idleSuspended = 0;
+    lastTimeMS = 0;
+    g_lookLastMs = 0.0;
+    g_lastFrameMs = 0.0;
+}
+
+// called by every callback that may change the picture
+void requestRedraw() {
+    if (g_windowHidden) return;
+    onDemandSettle();
+    if (g_idleSuspended) glutIdleFunc(idle);
+    glutPostRedisplay();
+}
+
+// samples that passed the depth test in the colour pass, read back
+// GPU_TIMER_LAG frames later and charged to the mode that drew them
+struct OverdrawQuery { GLuint q[GPU_TIMER_LAG]; int pending[GPU_TIMER_LAG], mode[GPU_TIMER_LAG]; double samples[GPU_TIMER_LAG]; };
+OverdrawQuery g_overdrawQuery;
+
+static void overdrawQueryBegin() {
+    OverdrawQuery& o = g_overdrawQuery;
+    int i = g_frameIndex % GPU_TIMER_LAG;
+    if (!o.q[0]) glGenQueries(GPU_TIMER_LAG, o.q);
+    if (o.pending[i]) {
+        GLint ready = 0;
+        glGetQueryObjectiv(o.q[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (ready && o.samples[i] > 0.0) {
+            GLuint n = 0;
+            glGetQueryObjectuiv(o.q[i], GL_QUERY_RESULT, &n);
+            float v = (float)(n / o.samples[i]);
+            float& m = g_overdraw[o.mode[i]];
+            m = m > 0.0f ? m + (v - m) * 0.2f : v;
+        }
+    }
+    GLint samples = 1;
+    glGetIntegerv(GL_SAMPLES, &samples);
+    o.samples[i] = (double)g_sceneW * g_sceneH * (samples > 1 ? samples : 1);
+    o.mode[i] = orderMode();
+    o.pending[i] = 1;
+    glBeginQuery(GL_SAMPLES_PASSED, o.q[i]);
+}
+
+// same rule as aaRecordFrame(); the overdraw view itself doesn't shade, so it isn't timed
+void overdrawRecordFrame(float gpuMs) {
+    if (g_overdrawView || g_frameIndex - g_overdrawSwitchFrame <= GPU_TIMER_LAG + 1 || gpuMs <= 0.0f) return;
+    float& m = g_overdrawFrameMs[orderMode()];
+    m = m > 0.0f ? m + (gpuMs - m) * 0.05f : gpuMs;
+}
+
+static void scenePassBegin(int pass) {
+    g_scenePass = pass;
+    GLboolean color = pass != PASS_DEPTH;
+    glColorMask(color, color, color, color);
+    if (pass == PASS_OVERDRAW) { glEnable(GL_BLEND); glBlendFunc(GL_ONE, GL_ONE); }
+    if (g_prepassDone) { glDepthFunc(GL_EQUAL); glDepthMask(GL_FALSE); }
+    glUseProgram(passProgram());
+}
+
+static void scenePassEnd() {
+    glUseProgram(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDisable(GL_BLEND);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    g_scenePass = PASS_SHADE;
+}
+
+// the opaque scene through the active path; runs once per pass
+static void drawOpaqueScene() {
+    int immediate = !gpuDrivenActive() && !(g_batch_on && g_batchSupported);
+    if (gpuDrivenActive()) drawGpuScene();
+    else if (!immediate) drawStaticBatch();
+    else if (!g_frontToBack) drawRoom();
+
+    int order[OBJ_COUNT];
+    sceneDrawOrder(order);
+    for (int k = 0; k < OBJ_COUNT; ++k) {
+        int o = order[k];
+        if (!g_objects[o].visible) continue;
+        if (o == OBJ_EARTH && !gpuDrivenActive()) drawTexturedEarth(0.18f);
+        else if (!immediate) continue;
+        else if (o == OBJ_TABLE) drawTable();
+        else if (o >= OBJ_CHAIR0 && o <= OBJ_CHAIR3) {
+            glPushMatrix(); glMultMatrixf(xformWorld(XF_CHAIR0 + o - OBJ_CHAIR0)); drawChair(); glPopMatrix();
+        }
+    }
+
+    drawBulbLampAndLight();
+    if (immediate && g_frontToBack) drawRoom();
+    drawStressScene();
+}
+
+// draws the 3D scene into the bound framebuffer (shared by display() and offline rendering)
+void renderScene() {
+    DRAW_SCOPE();
+    frameArenaBegin();
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    g_meshTris = 0;
+    if (volfogActive()) glDisable(GL_FOG);  // the froxel grid replaces it in the composite
+    else glEnable(GL_FOG);
+
+    // camera
+    streamBeginFrame();
+    animateSceneTransforms();
+    updateCameraBasis();
+    computeCameraMatrices();
+    cullScene();
+    texStreamUpdate();
+    frameConstantsUpdate();
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt(eyeX, eyeY, eyeZ, eyeX + fwdX, eyeY + fwdY, eyeZ + fwdZ, upX, upY, upZ);
+
+    // lights (params updated per frame)
+    setupHorrorLights();
+
+    // scene: optional depth-only pass, then shading (or counting) at GL_EQUAL
+    int colorPass = g_overdrawView && g_flatProg ? PASS_OVERDRAW : PASS_SHADE;
+    int measure = showStats || colorPass == PASS_OVERDRAW;
+    if (orderMode() & ORDER_PREPASS) {
+        scenePassBegin(PASS_DEPTH);
+        drawOpaqueScene();
+        g_prepassDone = 1;
+    }
+    scenePassBegin(colorPass);
+    if (measure) overdrawQueryBegin();
+    drawOpaqueScene();
+    if (measure) glEndQuery(GL_SAMPLES_PASSED);
+    scenePassEnd();
+    g_prepassDone = 0;
+
+    axes();
+}
+
+void display() {
+    PROFILE_FUNCTION();
+    double now = nowMs();
+    if (g_lastFrameMs > 0.0) g_frameMs += ((float)(now - g_lastFrameMs) - g_frameMs) * 0.1f;
+    g_lastFrameMs = now;
+    g_frameIndex++;
+
+    latencyPoll();
+    if (g_lateLatch) {
+        // re-sample look input that arrived since idle() and rebuild the view from it
+        updateLook();
+        latencyConsumeInput(1);
+    }
+
+    gpuTimerBegin(g_gpuFrame);
+    int offscreen = sceneBegin();
+    renderScene();
+    if (offscreen) sceneResolve(0, win_width, win_height);
+
+    // capture the scene without the text overlay
+    captureCollect(0);
+    captureIssue(win_width, win_height);
+
+    displayLabel();
+    gpuTimerEnd(g_gpuFrame);
+    latencySubmitted();
+    {
+        PROFILE_ZONE("glutSwapBuffers");
+        glutSwapBuffers();
+    }
+    latencySwapped();
+    GL_STATS_END_FRAME();
+    ALLOC_CHECK_END_FRAME();
+
+    if (g_dynres_on) dynresUpdate(g_gpuTimersSupported ? g_gpuFrame.ms : g_frameMs);
+    if (g_gpuTimersSupported && !g_dynres_on) {
+        aaRecordFrame(g_gpuFrame.ms);
+        overdrawRecordFrame(g_gpuFrame.ms);
+    }
+}
+
+void idle() {
+    PROFILE_FUNCTION();
+    if (g_idleSuspended) idleResume();
+    int t = glutGet(GLUT_ELAPSED_TIME);
+    if (lastTimeMS == 0) lastTimeMS = t;
+    int dtMS = t - lastTimeMS;
+    lastTimeMS = t;
+    float dt = dtMS * 0.001f;
+
+    if (animate_on) {
+        timeSec += dt;
+        earthAngle += 10.0f * dt;
+        if (earthAngle >= 360.0f) earthAngle -= 360.0f;
+    }
+
+    updateLook();
+    latencyConsumeInput(0);
 
     // smooth movement
     updateCameraBasis();
@@ -674,18 +5525,574 @@ void idle() {
     eyeZ = clampf(eyeZ, -ROOM_D * 0.5f + margin, ROOM_D * 0.5f - margin);
     eyeY = clampf(eyeY, 0.20f, ROOM_H - 0.20f);
 
-    // bulb flicker factor
-    g_flicker = computeFlicker(timeSec);
+    // bulb and stress-room flicker
+    updateLightAnimation(timeSec);
 
-    glutPostRedisplay();
+    // texture streaming, and textures and room.cfg edited on disk
+    int loaded = texLoaderApply();
+
+    if (!g_onDemand || loaded || sceneChanging(L > 0.0001f)) { onDemandSettle(); glutPostRedisplay(); }
+    else if (g_settleFrames > 0) { g_settleFrames--; glutPostRedisplay(); }
+    else idleSuspend();
+}
+
+// the window is hidden or fully covered: stop simulating and drawing
+void windowStatus(int state) {
+    g_windowHidden = state == GLUT_HIDDEN || state == GLUT_FULLY_COVERED;
+    if (g_windowHidden) idleSuspend();
+    else requestRedraw();
+}
+
+// ---------------- Offline render (--render-path) ----------------
+// Renders a camera spline at a fixed dt into an image sequence, as fast as
+// the GPU and the writers allow. Every piece of animation state is computed
+// from the frame's time rather than accumulated, so a frame comes out the
+// same no matter how the range is split across processes (--shard k/N).
+struct PathKey { float t, x, y, z, yaw, pitch; };
+struct OfflineJob { const char* pathFile; const char* outDir; int first, last; float fps; int w, h, shard, shards, raw; };
+OfflineJob g_offline = { NULL, "render", 0, -1, 30.0f, 1280, 720, 0, 1, 0 };
+std::vector<PathKey> g_pathKeys;
+
+// path file: one key per line, "t x y z yawDeg pitchDeg", '#' starts a comment
+static int loadCameraPath(const char* file) {
+    FILE* f = fopen(file, "r");
+    if (!f) { printf("Offline: cannot open camera path '%s'\n", file); return 0; }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        PathKey k;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%f %f %f %f %f %f", &k.t, &k.x, &k.y, &k.z, &k.yaw, &k.pitch) != 6) continue;
+        if (!g_pathKeys.empty() && k.t <= g_pathKeys.back().t) {
+            printf("Offline: key times in '%s' must increase (t=%.3f)\n", file, k.t);
+            fclose(f);
+            return 0;
+        }
+        g_pathKeys.push_back(k);
+    }
+    fclose(f);
+    if (g_pathKeys.size() < 2) { printf("Offline: '%s' needs at least two keys\n", file); return 0; }
+    return 1;
+}
+
+static float catmullRom(float p0, float p1, float p2, float p3, float u) {
+    return 0.5f * ((2.0f * p1) + (-p0 + p2) * u + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * u * u +
+        (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * u * u * u);
+}
+
+static void sampleCameraPath(float t, PathKey* out) {
+    int n = (int)g_pathKeys.size(), i = 0;
+    t = clampf(t, g_pathKeys[0].t, g_pathKeys[n - 1].t);
+    while (i < n - 2 && t >= g_pathKeys[i + 1].t) ++i;
+    const PathKey& k0 = g_pathKeys[i > 0 ? i - 1 : 0];
+    const PathKey& k1 = g_pathKeys[i];
+    const PathKey& k2 = g_pathKeys[i + 1];
+    const PathKey& k3 = g_pathKeys[i + 2 < n ? i + 2 : n - 1];
+    float u = (t - k1.t) / (k2.t - k1.t);
+    out->t = t;
+    out->x = catmullRom(k0.x, k1.x, k2.x, k3.x, u);
+    out->y = catmullRom(k0.y, k1.y, k2.y, k3.y, u);
+    out->z = catmullRom(k0.z, k1.z, k2.z, k3.z, u);
+    out->yaw = catmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, u);
+    out->pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, u);
+}
+
+// animation state as a function of time; idle() integrates the same rates
+static void setAnimationTime(float t) {
+    animate_on = 1;
+    timeSec = t;
+    earthAngle = fmodf(10.0f * t, 360.0f);
+    updateLightAnimation(t);
+}
+
+int runOfflineRender() {
+    if (!loadCameraPath(g_offline.pathFile)) return 1;
+    if (!g_capSupported || !(GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object)) {
+        printf("Offline: needs framebuffer objects and sync objects\n");
+        return 1;
+    }
+    float fps = g_offline.fps;
+    int first = g_offline.first;
+    int last = g_offline.last >= 0 ? g_offline.last : (int)floorf(g_pathKeys.back().t * fps);
+    // contiguous block for this shard
+    int count = last - first + 1, per = (count + g_offline.shards - 1) / g_offline.shards;
+    int f0 = first + g_offline.shard * per, f1 = f0 + per - 1;
+    if (f1 > last) f1 = last;
+    if (f0 > f1) { printf("Offline: shard %d/%d has no frames\n", g_offline.shard, g_offline.shards); return 0; }
+
+    RenderTarget rt = {};
+    if (!createRenderTarget(rt, g_offline.w, g_offline.h, 1)) return 1;
+    makeDir(g_offline.outDir);
+    g_capSeqDir = g_offline.outDir;
+    g_capSeqRaw = g_offline.raw;
+    win_width = g_offline.w; win_height = g_offline.h;
+    g_volfogTemporal = 0;   // keep frames independent of render order and sharding
+    glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+    glViewport(0, 0, rt.w, rt.h);
+    applyProjection();
+
+    printf("Offline: frames %d..%d of %d..%d at %.2f fps, %dx%d -> '%s'\n", f0, f1, first, last, fps, rt.w, rt.h, g_offline.outDir);
+    double t0 = nowMs();
+    int lost0 = g_capStats.dropped + g_capStats.failed + g_capWriteErrors;
+    GL_STATS_RESET();
+    for (int f = f0; f <= f1; ++f) {
+        float t = f / fps;
+        PathKey k;
+        sampleCameraPath(t, &k);
+        eyeX = k.x; eyeY = k.y; eyeZ = k.z; yawDeg = k.yaw; pitchDeg = k.pitch;
+        setAnimationTime(t);
+        PROFILE_ZONE("offline frame");
+        if (sceneBegin()) {
+            renderScene();
+            sceneResolve(rt.fbo, rt.w, rt.h);
+        }
+        else {
+            glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo);
+            glViewport(0, 0, rt.w, rt.h);
+            renderScene();
+        }
+        if (!captureRead(rt.w, rt.h, CAP_SEQUENCE, f, 1)) printf("Offline: frame %d was not captured\n", f);
+        GL_STATS_END_FRAME();
+        if ((f - f0) % 60 == 59) printf("Offline: %d/%d frames\n", f - f0 + 1, f1 - f0 + 1);
+    }
+    captureFlush();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    captureShutdown(); // waits for the writers to finish
+    destroyRenderTarget(rt);
+
+    double sec = (nowMs() - t0) * 0.001;
+    int frames = f1 - f0 + 1;
+    printf("Offline: %d frames in %.2f s (%.1f fps, %.2fx real time)\n", frames, sec, frames / sec, frames / sec / fps);
+    GL_STATS_PRINT("Offline");
+    int lost = g_capStats.dropped + g_capStats.failed + g_capWriteErrors - lost0;
+    if (lost) { printf("Offline: %d of %d frames were not written\n", lost, frames); return 1; }
+    return 0;
+}
+
+// ---------------- Performance suite (--perf-suite) ----------------
+// Renders a matrix of scenes x quality settings headless along a fixed orbit
+// and compares frame-time percentiles, GL call counts (with ROOM_GL_STATS)
+// and per-phase times against a baseline file. Timings are per machine, call
+// counts are not: record with --update-baseline on the reference box (see
+// perf/baseline.txt for the committed one) and commit the file.
+// Exit code 0: pass, 1: regression, 2: setup error.
+struct PerfScene { const char* name; int chairs, rooms; };
+struct PerfQuality { const char* name; int aa, post, postPreset, fog; };
+const PerfScene kPerfScenes[] = { { "stock", 0, 0 }, { "chairs100", 100, 0 }, { "chairs10k", 10000, 0 }, { "building", 0, 3 } };
+const PerfQuality kPerfQualities[] = {
+    { "low", AA_NONE, 0, POST_LOW, 0 },
+    { "medium", AA_FXAA, 1, POST_LOW, 1 },
+    { "high", AA_MSAA4, 1, POST_HIGH, 1 },
+};
+enum { PHASE_CULL, PHASE_DRAW, PHASE_RESOLVE, PHASE_GPU, PHASES };
+const char* kPhaseName[PHASES] = { "cull", "draw", "resolve", "gpu-wait" };
+struct PerfResult {
+    char scene[32], quality[32];
+    float p50, p95, calls;          // calls < 0: not measured
+    float phase[PHASES];            // medians, ms
+};
+
+const char* g_perfBaseline = NULL;
+int g_perfUpdate = 0;
+int g_perfFrames = 240;
+float g_perfTolerance = 0.10f;      // relative slack on top of the measured spread
+
+static int loadPerfBaseline(const char* file, std::vector<PerfResult>& out) {
+    FILE* f = fopen(file, "r");
+    if (!f) return 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        PerfResult r;
+        if (sscanf(line, "%31s %31s %f %f %f %f %f %f %f", r.scene, r.quality, &r.p50, &r.p95, &r.calls,
+                &r.phase[0], &r.phase[1], &r.phase[2], &r.phase[3]) == 9)
+            out.push_back(r);
+    }
+    fclose(f);
+    return 1;
+}
+
+static int savePerfBaseline(const char* file, const std::vector<PerfResult>& res) {
+    FILE* f = fopen(file, "w");
+    if (!f) { printf("Perf: cannot write '%s'\n", file); return 0; }
+    fprintf(f, "# room perf baseline: %s, %dx%d, %d frames per case\n", (const char*)glGetString(GL_RENDERER), g_offline.w, g_offline.h, g_perfFrames);
+#ifdef ROOM_GL_STATS
+    fprintf(f, "# built with ROOM_GL_STATS: gl_calls are exact and independent of machine speed\n");
+#else
+    fprintf(f, "# built without ROOM_GL_STATS: gl_calls not measured (-1)\n");
+#endif
+    fprintf(f, "# scene quality p50_ms p95_ms gl_calls");
+    for (int p = 0; p < PHASES; ++p) fprintf(f, " %s_ms", kPhaseName[p]);
+    fprintf(f, "\n");
+    for (const PerfResult& r : res) {
+        fprintf(f, "%s %s %.3f %.3f %.0f", r.scene, r.quality, r.p50, r.p95, r.calls);
+        for (int p = 0; p < PHASES; ++p) fprintf(f, " %.3f", r.phase[p]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    return 1;
+}
+
+// one case: fixed orbit around the table, fixed animation steps
+static PerfResult runPerfCase(const PerfScene& sc, const PerfQuality& q, const RenderTarget& rt) {
+    g_stressChairs = sc.chairs; g_stressRooms = sc.rooms;
+    buildStressScene();
+    g_aaMode = aaSupported(q.aa) ? q.aa : AA_NONE;
+    g_post_on = q.post; g_postPreset = q.postPreset;
+    g_volfog_on = q.fog;
+    g_fogHistoryValid = 0;
+
+    std::vector<float> total, phase[PHASES];
+    const int warmup = 20;
+    GL_STATS_RESET();
+    for (int f = -warmup; f < g_perfFrames; ++f) {
+        float a = 6.2831853f * (f + warmup) / (g_perfFrames + warmup);
+        eyeX = 2.6f * cosf(a); eyeZ = 2.6f * sinf(a); eyeY = 1.4f;
+        yawDeg = atan2f(-eyeZ, -eyeX) / DEG2RAD; pitchDeg = -10.0f;
+        setAnimationTime((f + warmup) / 60.0f);
+
+        double t0 = nowMs();
+        int offscreen = sceneBegin();
+        if (!offscreen) { glBindFramebuffer(GL_FRAMEBUFFER, rt.fbo); glViewport(0, 0, rt.w, rt.h); }
+        renderScene();
+        double t1 = nowMs();
+        if (offscreen) sceneResolve(rt.fbo, rt.w, rt.h);
+        double t2 = nowMs();
+        glFinish();
+        double t3 = nowMs();
+        if (f == 0) GL_STATS_RESET();
+        GL_STATS_END_FRAME();
+        if (f < 0) continue;
+        total.push_back((float)(t3 - t0));
+        phase[PHASE_CULL].push_back(g_occStats.lastMs);
+        phase[PHASE_DRAW].push_back((float)(t1 - t0) - g_occStats.lastMs);
+        phase[PHASE_RESOLVE].push_back((float)(t2 - t1));
+        phase[PHASE_GPU].push_back((float)(t3 - t2));
+    }
+
+    PerfResult r;
+    snprintf(r.scene, sizeof(r.scene), "%s", sc.name);
+    snprintf(r.quality, sizeof(r.quality), "%s", q.name);
+    r.p50 = percentile(total, 0.50f);
+    r.p95 = percentile(total, 0.95f);
+    r.calls = -1.0f;
+#ifdef ROOM_GL_STATS
+    double calls = 0;
+    for (int c = 0; c < GLS_CATEGORIES; ++c) calls += g_glsSum[c];
+    r.calls = (float)(calls / (g_glsFrames ? g_glsFrames : 1));
+#endif
+    for (int p = 0; p < PHASES; ++p) r.phase[p] = percentile(phase[p], 0.50f);
+    return r;
+}
+
+// A case regresses when its median leaves the baseline's own noise band
+// (the p50..p95 spread) by more than the relative tolerance, when its p95
+// does so by twice the tolerance, or when it makes >2% more GL calls.
+static int comparePerf(const PerfResult& r, const PerfResult& b) {
+    float spread = fmaxf(b.p95 - b.p50, 0.0f);
+    float slack50 = fmaxf(g_perfTolerance * b.p50, fmaxf(0.5f * spread, 0.1f));
+    float slack95 = fmaxf(2.0f * g_perfTolerance * b.p95, fmaxf(spread, 0.2f));
+    int bad = 0;
+    if (r.p50 > b.p50 + slack50) { printf("    p50 %.2f ms > baseline %.2f + %.2f\n", r.p50, b.p50, slack50); bad = 1; }
+    if (r.p95 > b.p95 + slack95) { printf("    p95 %.2f ms > baseline %.2f + %.2f\n", r.p95, b.p95, slack95); bad = 1; }
+    if (r.calls >= 0.0f && b.calls >= 0.0f && r.calls > b.calls * 1.02f + 10.0f) {
+        printf("    GL calls %.0f > baseline %.0f\n", r.calls, b.calls);
+        bad = 1;
+    }
+    if (bad) {
+        // attribute the change to the phases that grew the most
+        int order[PHASES] = { 0, 1, 2, 3 };
+        std::sort(order, order + PHASES, [&](int x, int y) { return r.phase[x] - b.phase[x] > r.phase[y] - b.phase[y]; });
+        for (int i = 0; i < PHASES; ++i) {
+            int p = order[i];
+            float d = r.phase[p] - b.phase[p];
+            if (d <= fmaxf(g_perfTolerance * b.phase[p], 0.05f)) break;
+            printf("    phase %-8s %.2f -> %.2f ms (+%.2f)\n", kPhaseName[p], b.phase[p], r.phase[p], d);
+        }
+    }
+    return bad;
+}
+
+int runPerfSuite() {
+    RenderTarget rt = {};
+    if (!createRenderTarget(rt, g_offline.w, g_offline.h, 1)) return 2;
+    win_width = g_offline.w; win_height = g_offline.h;
+    applyProjection();
+    g_dynres_on = 0;
+    occlusion_on = 1; lod_on = 1; animate_on = 1;
+
+    std::vector<PerfResult> base, res;
+    int haveBase = loadPerfBaseline(g_perfBaseline, base);
+    if (!haveBase && !g_perfUpdate) { printf("Perf: no baseline '%s' (record one with --update-baseline)\n", g_perfBaseline); return 2; }
+    printf("Perf: %s, %dx%d, %d frames per case\n", (const char*)glGetString(GL_RENDERER), rt.w, rt.h, g_perfFrames);
+    printf("%-10s %-7s %8s %8s %8s", "scene", "quality", "p50", "p95", "calls");
+    for (int p = 0; p < PHASES; ++p) printf(" %8s", kPhaseName[p]);
+    printf("\n");
+
+    int regressions = 0;
+    for (const PerfScene& sc : kPerfScenes)
+        for (const PerfQuality& q : kPerfQualities) {
+            PerfResult r = runPerfCase(sc, q, rt);
+            res.push_back(r);
+            printf("%-10s %-7s %8.2f %8.2f %8.0f", r.scene, r.quality, r.p50, r.p95, r.calls);
+            for (int p = 0; p < PHASES; ++p) printf(" %8.2f", r.phase[p]);
+            printf("\n");
+            if (g_perfUpdate) continue;
+            const PerfResult* b = NULL;
+            for (const PerfResult& x : base) if (!strcmp(x.scene, r.scene) && !strcmp(x.quality, r.quality)) b = &x;
+            if (!b) printf("    (no baseline entry)\n");
+            else regressions += comparePerf(r, *b);
+        }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    destroyRenderTarget(rt);
+    g_stressChairs = g_stressRooms = 0;
+    buildStressScene();
+
+    if (g_perfUpdate) return savePerfBaseline(g_perfBaseline, res) ? 0 : 2;
+    printf("Perf: %d of %d cases regressed\n", regressions, (int)res.size());
+    return regressions ? 1 : 0;
+}
+
+// ---------------- Benchmarks (--bench-*) ----------------
+// CPU-only microbenchmarks; they run before glutInit, so no window or GL
+// context is needed.
+
+// Checks the kernel against computeFlicker over an hour of samples, then
+// times the libm reference, the scalar kernel and the SIMD kernel on
+// `count` mixed-style lights.
+static int runFlickerBench(int count) {
+    if (count < 8) count = 8;
+    LightAnimSoA ref;
+    ref.add(FLICKER_STEADY, 0.0f, 0.0f);
+    const int samples = 3600 * 240;
+    int dipMismatch = 0;
+    float maxErr = 0.0f;
+    for (int k = 0; k < samples; ++k) {
+        float t = k / 240.0f;
+        flickerEvaluate(ref, t);
+        float want = computeFlicker(t);
+        float n = fractf(sinf(47.0f * t) * 125.0f);
+        int wantDip = n < 0.035f, gotDip = fractf(flickerSin(47.0f * t) * 125.0f) < 0.035f;
+        if (wantDip != gotDip) { ++dipMismatch; continue; }    // hash landed on the other side of the threshold
+        maxErr = fmaxf(maxErr, fabsf(ref.out[0] - want));
+    }
+    printf("Flicker: vs computeFlicker over %d samples: max error %.2e, dip mismatches %d (%.4f%%)\n",
+        samples, maxErr, dipMismatch, 100.0 * dipMismatch / samples);
+
+    buildSceneLights(count);
+    LightAnimSoA& L = g_lightAnim;
+    std::vector<float> refOut(count);
+    const int iters = 50;
+    double t0 = nowMs();
+    for (int it = 0; it < iters; ++it)
+        for (int i = 0; i < count; ++i) refOut[i] = computeFlicker(it * 0.016f + L.phase[i]);
+    double refMs = (nowMs() - t0) / iters;
+    t0 = nowMs();
+    for (int it = 0; it < iters; ++it) flickerScalar(L, it * 0.016f, 0, count);
+    double scalarMs = (nowMs() - t0) / iters;
+    t0 = nowMs();
+    for (int it = 0; it < iters; ++it) flickerEvaluate(L, it * 0.016f);
+    double simdMs = (nowMs() - t0) / iters;
+    float sum = 0.0f;
+    for (int i = 0; i < count; ++i) sum += L.out[i] + refOut[i];  // keep the loops alive
+    printf("Flicker: %d lights  libm %.3f ms (%.0f/ms)  scalar %.3f ms (%.0f/ms)  %s %.3f ms (%.0f/ms)  [%.1f]\n", count,
+        refMs, count / refMs, scalarMs, count / scalarMs,
+#if defined(__AVX2__)
+        "avx2",
+#elif defined(__SSE2__) || defined(_M_X64)
+        "sse2",
+#else
+        "kernel",
+#endif
+        simdMs, count / simdMs, sum / count);
+    return (maxErr < 1e-4f && dipMismatch * 1000 < samples) ? 0 : 1;
+}
+
+// Times stress-building command recording (cull, LOD, command lists, merge)
+// with 1-16 threads in the job system. The camera looks across the building
+// from a corner and the occlusion buffer is empty, so everything in the frustum
+// is recorded. Every thread count must produce the same merged list.
+static int runRecordBench(int rooms) {
+    if (rooms < 2) rooms = 2;
+    g_stressRooms = rooms; g_stressChairs = 10000;
+    buildStressScene();
+    eyeX = -rooms * 0.5f * ROOM_W; eyeY = 40.0f; eyeZ = -rooms * 0.5f * ROOM_D;   // a corner, looking at the far one
+    yawDeg = 135.0f; pitchDeg = -20.0f; z_far = 2.0f * rooms * ROOM_W;
+    updateCameraBasis();
+    computeCameraMatrices();
+    occlusion_on = 1;
+    for (int i = 0; i < OCC_W * OCC_H; ++i) g_occDepth[i] = 1.0f;
+
+    const int threads[] = { 1, 2, 4, 6, 8, 12, 16 }, iters = 40;
+    unsigned hw = std::thread::hardware_concurrency();
+    printf("Record: %dx%d rooms + %d chairs, %d items in chunks of %d, %u hardware threads\n", rooms, rooms,
+        g_stressChairs, rooms * rooms + g_stressChairs, STRESS_CHUNK, hw);
+    double base = 0.0;
+    uint64_t refHash = 0;
+    int refCount = -1, ok = 1;
+    for (int t : threads) {
+        jobStart(t - 1);
+        const StressCmd* cmd = nullptr;
+        int count = 0;
+        std::vector<float> ms, merge;
+        for (int it = 0; it < iters + 5; ++it) {
+            frameArenaBegin();
+            double t0 = nowMs();
+            count = stressRecord(&cmd);
+            if (it >= 5) { ms.push_back((float)(nowMs() - t0)); merge.push_back(g_stressMergeMs); }
+        }
+        jobStop();
+        uint64_t hash = 1469598103934665603ull;
+        for (int i = 0; i < count; ++i) hash = (hash ^ cmd[i].key ^ (uint64_t)cmd[i].lod << 60) * 1099511628211ull;
+        if (refCount < 0) { refCount = count; refHash = hash; }
+        else if (count != refCount || hash != refHash) ok = 0;
+        float p50 = percentile(ms, 0.5f);
+        if (t == 1) base = p50;
+        printf("Record: %2d thread%s  %7.3f ms  (p95 %7.3f, merge %.3f)  speedup %5.2fx  %d commands%s\n", t, t > 1 ? "s" : " ", p50,
+            percentile(ms, 0.95f), percentile(merge, 0.5f), base / p50, count, (count == refCount && hash == refHash) ? "" : "  MISMATCH");
+    }
+    g_stressRooms = g_stressChairs = 0;
+    return ok ? 0 : 1;
+}
+
+// Job system microbenchmarks with 1-16 threads: spawn overhead (empty
+// jobs, spawned and waited on in batches), a dependency chain where each job
+// runs after the previous one's counter, and parallel-for over a light
+// per-item kernel with the automatic grain and with one item per job.
+// Results must match a serial run.
+static void benchKernel(int i, void* ctx) {
+    float x = i * 1e-3f;
+    ((float*)ctx)[i] = flickerSin(x) * flickerSin(x * 1.7f + 0.3f);
+}
+static int runJobBench(int items) {
+    if (items < 1024) items = 1024;
+    std::vector<float> ref(items), out(items);
+    for (int i = 0; i < items; ++i) benchKernel(i, ref.data());
+    const int threads[] = { 1, 2, 4, 8, 12, 16 }, batch = 1000, batches = 100, chain = 2000;
+    struct Link { std::atomic<int>* seq; int ran; };
+    std::vector<JobCounter> counters(chain);
+    std::vector<Link> links(chain);
+    unsigned hw = std::thread::hardware_concurrency();
+    printf("Jobs: %u hardware threads, parallel-for over %d items\n", hw, items);
+    double base = 0.0;
+    int ok = 1;
+    for (int t : threads) {
+        jobStart(t - 1);
+        // spawn + run + wait, amortized per job
+        double t0 = nowMs();
+        for (int b = 0; b < batches; ++b) {
+            JobCounter done;
+            for (int k = 0; k < batch; ++k) jobSpawn([](int, void*) {}, nullptr, 1, 1, &done);
+            jobWait(done);
+        }
+        double spawnNs = (nowMs() - t0) * 1e6 / (batch * batches);
+
+        // chain: job k may only start once job k-1 finished
+        std::atomic<int> seq{ 0 };
+        t0 = nowMs();
+        for (int k = 0; k < chain; ++k) {
+            links[k] = Link{ &seq, -1 };
+            jobSpawn([](int, void* c) { Link* l = (Link*)c; l->ran = l->seq->fetch_add(1); }, &links[k], 1, 1,
+                &counters[k], k ? &counters[k - 1] : nullptr);
+        }
+        for (JobCounter& c : counters) jobWait(c);
+        double chainNs = (nowMs() - t0) * 1e6 / chain;
+        int chainOk = 1;
+        for (int k = 0; k < chain; ++k) chainOk &= links[k].ran == k;
+
+        // parallel-for, automatic grain and one item per job
+        std::vector<float> ms, fine;
+        for (int it = 0; it < 12; ++it) {
+            std::fill(out.begin(), out.end(), 0.0f);
+            t0 = nowMs();
+            jobParallelFor(items, benchKernel, out.data());
+            if (it >= 2) ms.push_back((float)(nowMs() - t0));
+        }
+        int forOk = !memcmp(out.data(), ref.data(), items * sizeof(float));
+        for (int it = 0; it < 4; ++it) {
+            t0 = nowMs();
+            jobParallelFor(items, benchKernel, out.data(), 1);
+            fine.push_back((float)(nowMs() - t0));
+        }
+        forOk &= !memcmp(out.data(), ref.data(), items * sizeof(float));
+        jobStop();
+
+        float p50 = percentile(ms, 0.5f);
+        if (t == 1) base = p50;
+        ok &= chainOk & forOk;
+        printf("Jobs: %2d thread%s  spawn %6.0f ns/job  chain %6.0f ns/link%s  parallel-for %7.3f ms (speedup %5.2fx, grain 1: %7.3f ms)%s\n",
+            t, t > 1 ? "s" : " ", spawnNs, chainNs, chainOk ? "" : " (BROKEN)", p50, base / p50, percentile(fine, 0.5f),
+            forOk ? "" : "  MISMATCH");
+    }
+    return ok ? 0 : 1;
+}
+
+// returns the exit code when argv[1] names a benchmark, -1 otherwise
+static int runBenchmarks(int argc, char** argv) {
+    if (argc < 2 || strncmp(argv[1], "--bench-", 8)) return -1;
+    const char* v = argc > 2 ? argv[2] : "";
+    if (!strcmp(argv[1], "--bench-flicker")) return runFlickerBench(*v ? atoi(v) : 100000);
+    if (!strcmp(argv[1], "--bench-record")) return runRecordBench(*v ? atoi(v) : 64);
+    if (!strcmp(argv[1], "--bench-jobs")) return runJobBench(*v ? atoi(v) : 1 << 20);
+    printf("Unknown benchmark '%s'\n", argv[1]);
+    return 1;
+}
+
+// ---------------- Command line ----------------
+static void parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        const char* v = (i + 1 < argc) ? argv[i + 1] : "";
+        if (!strcmp(a, "--render-path")) { g_offline.pathFile = v; ++i; }
+        else if (!strcmp(a, "--out")) { g_offline.outDir = v; ++i; }
+        else if (!strcmp(a, "--frames")) { sscanf(v, "%d:%d", &g_offline.first, &g_offline.last); ++i; }
+        else if (!strcmp(a, "--fps")) { g_offline.fps = (float)atof(v); ++i; }
+        else if (!strcmp(a, "--size")) { sscanf(v, "%dx%d", &g_offline.w, &g_offline.h); ++i; }
+        else if (!strcmp(a, "--shard")) { sscanf(v, "%d/%d", &g_offline.shard, &g_offline.shards); ++i; }
+        else if (!strcmp(a, "--raw")) g_offline.raw = 1;
+        else if (!strcmp(a, "--post")) {
+            g_post_on = 1;
+            for (int p = 0; p < POST_PRESETS; ++p) if (!strcmp(v, kPostPresetName[p])) g_postPreset = p;
+            ++i;
+        }
+        else if (!strcmp(a, "--aa")) {
+            // off | fxaa | smaa | 2 | 4 | 8 (MSAA samples)
+            g_aaMode = !strcmp(v, "fxaa") ? AA_FXAA : !strcmp(v, "smaa") ? AA_SMAA : !strcmp(v, "2") ? AA_MSAA2 :
+                !strcmp(v, "4") ? AA_MSAA4 : !strcmp(v, "8") ? AA_MSAA8 : AA_NONE;
+            ++i;
+        }
+        else if (!strcmp(a, "--perf-suite")) { g_perfBaseline = v; ++i; }
+        else if (!strcmp(a, "--update-baseline")) g_perfUpdate = 1;
+        else if (!strcmp(a, "--perf-frames")) { g_perfFrames = atoi(v); ++i; }
+        else if (!strcmp(a, "--stress-chairs")) { g_stressChairs = atoi(v); ++i; }
+        else if (!strcmp(a, "--stress-rooms")) { g_stressRooms = atoi(v); ++i; }
+        else if (!strcmp(a, "--mouse-sens")) { mouseSensitivity = (float)atof(v); ++i; }
+        else if (!strcmp(a, "--tex-budget")) { g_texBudgetMB = (float)atof(v); ++i; }
+        else if (!strcmp(a, "--late-latch")) g_lateLatch = 1;
+        else if (!strcmp(a, "--on-demand")) g_onDemand = 1;
+        else if (!strcmp(a, "--depth-prepass")) g_depthPrepass = 1;
+        else if (!strcmp(a, "--front-to-back")) g_frontToBack = 1;
+        else if (!strcmp(a, "--overdraw")) g_overdrawView = 1;
+        else if (!strcmp(a, "--mouse-smooth")) { mouseSmoothing = (float)atof(v); ++i; }
+        else if (!strcmp(a, "--dynres")) { g_dynres_on = 1; g_dynresTargetMs = (float)atof(v); ++i; }
+        else printf("Unknown option '%s'\n", a);
+    }
+    if (g_offline.fps <= 0.0f) g_offline.fps = 30.0f;
+    if (g_dynresTargetMs <= 1.0f) g_dynresTargetMs = 14.0f;
+    if (mouseSmoothing < 0.0f) mouseSmoothing = 0.0f;
+    if (g_offline.shards < 1) g_offline.shards = 1;
+    g_offline.shard = (g_offline.shard < 0 || g_offline.shard >= g_offline.shards) ? 0 : g_offline.shard;
+    if (g_offline.w < 16) g_offline.w = 16;
+    if (g_offline.h < 16) g_offline.h = 16;
 }
 
 // ---------------- Init / reshape ----------------
 void reshape(int w, int h) {
+    ALLOC_CHECK_SETTLE();
     win_width = (w <= 0 ? 1 : w);
     win_height = (h <= 0 ? 1 : h);
     glViewport(0, 0, win_width, win_height);
     applyProjection();
+    requestRedraw();
 }
 
 void init() {
@@ -696,8 +6103,7 @@ void init() {
     glEnable(GL_NORMALIZE);
 
     // Antialiasing & nicer quality
-    //glEnable(GL_MULTISAMPLE);
-    glEnable(GLUT_MULTISAMPLE);
+    glEnable(GL_MULTISAMPLE);
 
     glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
 
@@ -718,34 +6124,68 @@ void init() {
     glFogf(GL_FOG_DENSITY, 0.06f);
     glHint(GL_FOG_HINT, GL_NICEST);
 
-    // Textures
-    texFloor = loadTextureSOIL("textures/floor.jpg", 1);
-    texWall = loadTextureSOIL("textures/wall.jpg", 1);
-    texCeil = loadTextureSOIL("textures/ceiling.jpg", 1);
-    texWood = loadTextureSOIL("textures/wood.jpg", 1);
-    texPainting = loadTextureSOIL("textures/painting.jpg", 1);
-    texEarth = loadTextureSOIL("textures/earth2.jpg", 1);
+    buildMeshes();
+    buildSceneObjects();
+    buildSceneTransforms();
+    buildOccluders();
+    buildStressScene();
+    g_gpuTimersSupported = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query) ? 1 : 0;
+    streamInit();
+    postInit();
+    aaInit(g_postSupported);
+    volfogInit(g_postSupported);
+    unsigned writers = std::thread::hardware_concurrency();
+    captureInit(g_offline.pathFile ? (int)(writers > 2 ? writers - 1 : 1) : 1);
+    jobStart((int)std::thread::hardware_concurrency() - 1);
+
+    // Textures (low mips now, the rest streams)
+    texStreamInit();
+    depthPrepassInit();
+    buildStaticBatch();
+    gpuDrivenInit();
 }
 
 // ---------------- Main ----------------
 int main(int argc, char** argv) {
+    PROFILE_THREAD("main");
+    int bench = runBenchmarks(argc, argv);
+    if (bench >= 0) return bench;
     glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA | GLUT_MULTISAMPLE);
+    loadSceneConfig(kSceneConfig);  // command-line options override it
+    parseArgs(argc, argv);
+    int offline = g_offline.pathFile != NULL || g_perfBaseline != NULL;
+    if (offline) { win_width = 64; win_height = 64; } // hidden; frames go to an FBO
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_DEPTH | GLUT_RGBA);
     glutInitWindowPosition(win_posx, win_posy);
     glutInitWindowSize(win_width, win_height);
     glutCreateWindow("Room: Smooth FPS + Horror Lighting + SOIL2 Textures");
 
+    GLenum glewErr = glewInit();
+    if (glewErr != GLEW_OK) {
+        printf("GLEW: %s\n", glewGetErrorString(glewErr));
+        return 1;
+    }
+    if (offline) glutHideWindow();
+
     // Input callbacks (FreeGLUT)
     glutKeyboardFunc(keyboardDown);
     glutKeyboardUpFunc(keyboardUp);
     glutSpecialFunc(onSpecialDown);
     glutSpecialUpFunc(onSpecialUp);
+    glutMotionFunc(mouseMotion);
+    glutPassiveMotionFunc(mouseMotion);
 
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutIdleFunc(idle);
+    glutWindowStatusFunc(windowStatus);
 
     init();
+    atexit([] { texLoaderStop(); captureShutdown(); jobStop(); PROFILE_DUMP(); }); // join workers before static destructors run
+    if (offline) texStreamLoadAll();
+    if (g_perfBaseline) return runPerfSuite();
+    if (offline) return runOfflineRender();
+    texLoaderStart();
     glutMainLoop();
     return 0;
 }